@@ -45,6 +45,22 @@ endif
 RELEASEVER  := "1.0.0"
 RELEASETIME := "2021-08-01 15:00 +0800"
 
+# build-time maximum log level per subsystem (0 none, 1 err, 2 warn,
+# 3 info, 4 detail, 5 all); more verbose printk()s are compiled out
+LOG_MAX_DEFAULT ?= 5
+LOG_MAX_TPM     ?= $(LOG_MAX_DEFAULT)
+LOG_MAX_TXT     ?= $(LOG_MAX_DEFAULT)
+LOG_MAX_LOADER  ?= $(LOG_MAX_DEFAULT)
+LOG_MAX_E820    ?= $(LOG_MAX_DEFAULT)
+LOG_MAX_SKINIT  ?= $(LOG_MAX_DEFAULT)
+
+CFLAGS		+= -DSLEXEC_LOG_MAX_DEFAULT=$(LOG_MAX_DEFAULT)
+CFLAGS		+= -DSLEXEC_LOG_MAX_TPM=$(LOG_MAX_TPM)
+CFLAGS		+= -DSLEXEC_LOG_MAX_TXT=$(LOG_MAX_TXT)
+CFLAGS		+= -DSLEXEC_LOG_MAX_LOADER=$(LOG_MAX_LOADER)
+CFLAGS		+= -DSLEXEC_LOG_MAX_E820=$(LOG_MAX_E820)
+CFLAGS		+= -DSLEXEC_LOG_MAX_SKINIT=$(LOG_MAX_SKINIT)
+
 # if target arch is 64b, then convert -m64 to -m32 (slexec is always 32b)
 CFLAGS		+= -m32
 CFLAGS		+= -march=i686
@@ -357,6 +357,16 @@ struct dmar_remapping {
     struct device_scope device_scope_entry[1]; /* Device Scope starts here */
 } __packed;
 
+struct dmar_rmrr {
+    uint16_t type;           /* DMAR_REMAPPING_RMRR */
+    uint16_t length;
+    uint16_t reserved;
+    uint16_t segment_number;
+    uint64_t base_address;
+    uint64_t limit_address;  /* last byte of the region, inclusive */
+    struct device_scope device_scope_entry[1]; /* Device Scope starts here */
+} __packed;
+
 struct acpi_dmar {
     struct acpi_table_header hdr;
 #define DMAR_SIG "DMAR"
@@ -387,8 +397,77 @@ struct acpi_mcfg {
 
 typedef struct acpi_mcfg acpi_table_mcfg_t;
 
+/* EFI system table, just enough of it to reach the configuration tables */
+typedef struct {
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t  data4[8];
+} __packed efi_guid_t;
+
+#define ACPI_TABLE_GUID \
+    { 0xeb9d2d30, 0x2d88, 0x11d3, { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } }
+#define ACPI_20_TABLE_GUID \
+    { 0x8868e871, 0xe4f1, 0x11d3, { 0xbc, 0x22, 0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81 } }
+
+struct efi_table_header {
+    uint64_t signature;
+#define EFI_SYSTEM_TABLE_SIGNATURE 0x5453595320494249ULL /* "IBI SYST" */
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t crc32;
+    uint32_t reserved;
+} __packed;
+
+struct efi_system_table32 {
+    struct efi_table_header hdr;
+    uint32_t fw_vendor;
+    uint32_t fw_revision;
+    uint32_t con_in_handle;
+    uint32_t con_in;
+    uint32_t con_out_handle;
+    uint32_t con_out;
+    uint32_t stderr_handle;
+    uint32_t stderr;
+    uint32_t runtime;
+    uint32_t boottime;
+    uint32_t nr_tables;
+    uint32_t tables;
+} __packed;
+
+struct efi_system_table64 {
+    struct efi_table_header hdr;
+    uint64_t fw_vendor;
+    uint32_t fw_revision;
+    uint32_t pad;
+    uint64_t con_in_handle;
+    uint64_t con_in;
+    uint64_t con_out_handle;
+    uint64_t con_out;
+    uint64_t stderr_handle;
+    uint64_t stderr;
+    uint64_t runtime;
+    uint64_t boottime;
+    uint64_t nr_tables;
+    uint64_t tables;
+} __packed;
+
+struct efi_config_table32 {
+    efi_guid_t guid;
+    uint32_t table;
+} __packed;
+
+struct efi_config_table64 {
+    efi_guid_t guid;
+    uint64_t table;
+} __packed;
+
 extern struct acpi_rsdp *get_rsdp(loader_ctx *lctx);
+extern struct acpi_table_header *get_acpi_table(const char *table_name);
 extern bool vtd_bios_enabled(void);
+extern uint16_t get_acpi_pm_timer(bool *is_32bit);
+extern unsigned int get_dmar_rmrrs(uint64_t *bases, uint64_t *limits,
+                                   unsigned int max);
 
 #endif	/* __ACPI_H__ */
 
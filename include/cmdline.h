@@ -46,7 +46,7 @@ extern bool get_slexec_serial(void);
 extern void get_slexec_baud(void);
 extern void get_slexec_vga_delay(void);
 extern bool get_slexec_prefer_da(void);
-extern uint32_t get_slexec_min_ram(void);
+extern uint32_t get_slexec_evtlog_events(void);
 extern bool get_ignore_prev_err(void);
 extern uint32_t get_error_shutdown(void);
 
@@ -55,7 +55,7 @@ extern void linux_parse_cmdline(const char *cmdline);
 extern bool get_linux_vga(int *vid_mode);
 extern bool get_linux_mem(uint64_t *initrd_max_mem);
 
-extern uint8_t get_loglvl_prefix(char **pbuf, int *len);
+extern uint8_t get_loglvl_prefix(const char **pfmt);
 
 #endif /* __CMDLINE_H__ */
 
@@ -295,6 +295,7 @@ typedef struct __packed {
 } serial_port_t;
 
 extern void comc_init(void);
+extern void comc_putc(char);
 extern void comc_puts(const char*, unsigned int);
 
 #endif /* __COM_H__ */
@@ -56,12 +56,24 @@
 #define E820_UNUSABLE       5
 #endif
 
+#ifndef E820_PMEM
+#define E820_PMEM           7
+#endif
+
+/* slexec's own types for the EFI memory map, never passed on */
+#define E820_EFI_BOOT       0x10000    /* loader and boot services */
+#define E820_EFI_RUNTIME    0x10001    /* runtime services */
+
 /* these are only used by e820_check_region() */
 #define E820_MIXED          ((uint32_t)-1 - 1)
 #define E820_GAP            ((uint32_t)-1)
 
 #define E820MAX             128
 
+/* e820_alloc() flags */
+#define E820_ALLOC_BOTTOM_UP 0
+#define E820_ALLOC_TOP_DOWN  1
+
 typedef struct __packed {
     uint64_t addr;    /* start of memory segment */
     uint64_t size;    /* size of memory segment */
@@ -86,6 +98,10 @@ extern bool get_ram_ranges(uint64_t *min_lo_ram, uint64_t *max_lo_ram,
                            uint64_t *min_hi_ram, uint64_t *max_hi_ram);
 extern void get_highest_sized_ram(uint64_t size, uint64_t limit,
                                   uint64_t *ram_base, uint64_t *ram_size);
+extern bool e820_alloc_init(loader_ctx *lctx);
+extern bool e820_alloc_exclude(uint64_t addr, uint64_t size);
+extern uint64_t e820_alloc(uint64_t size, uint64_t align, uint64_t limit,
+                           uint32_t flags, uint32_t type);
 
 /*
  * Memory map descriptor:
@@ -106,7 +122,8 @@ extern void get_highest_sized_ram(uint64_t size, uint64_t limit,
 #define EFI_MEMORY_MAPPED_IO		11
 #define EFI_MEMORY_MAPPED_IO_PORT_SPACE	12
 #define EFI_PAL_CODE			13
-#define EFI_MAX_MEMORY_TYPE		14
+#define EFI_PERSISTENT_MEMORY		14
+#define EFI_MAX_MEMORY_TYPE		15
 
 /* Attribute values: */
 #define EFI_MEMORY_UC		((u64)0x0000000000000001ULL)	/* uncached */
@@ -272,8 +272,17 @@ typedef struct {
 
 extern sl_kernel_setup_t g_sl_kernel_setup;
 
+/* an initrd piece, the kernel sees all of them as one ramdisk */
+#define LINUX_MAX_INITRDS    16
+
+typedef struct {
+    const void *image;
+    size_t size;
+} linux_initrd_t;
+
 extern bool expand_linux_image(const void *linux_image, size_t linux_size,
-                               const void *initrd_image, size_t initrd_size);
+                               const linux_initrd_t *initrds,
+                               unsigned int nr_initrds);
 
 extern void linux_skl_setup_indirect(setup_data_t *data, uint32_t adj_size);
 
@@ -39,6 +39,8 @@
 extern void print_hex(const char *prefix, const void *prtptr, size_t size);
 
 extern void delay(int millisecs);
+extern uint64_t get_tsc_ticks_per_millisec(void);
+extern uint64_t tsc_to_usecs(uint64_t ticks);
 
 /*
  *  These three "plus overflow" functions take a "x" value
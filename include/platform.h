@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+/*
+ * Everything the launch checks want to know about the CPU and chipset,
+ * read once up front. The TXT fields are only valid if txt_valid is set
+ * and need <txt/smx.h> and <txt/txt.h> for their types.
+ */
+typedef struct {
+    /* CPUID */
+    uint32_t vendor[3];            /* leaf 0 EBX, EDX, ECX */
+    uint32_t max_leaf;
+    uint32_t max_ext_leaf;
+    uint32_t fms;                  /* leaf 1 EAX */
+    uint32_t feat_ecx;             /* leaf 1 ECX */
+    uint32_t ext_feat_ebx;         /* leaf 7/0 EBX */
+    uint32_t ext_info_ecx;         /* leaf 0x80000001 ECX */
+
+    /* MSRs */
+    uint64_t apic_base;
+    uint64_t mcg_cap;
+    uint64_t feat_ctrl;            /* Intel with VMX or SMX */
+    uint64_t platform_id;          /* Intel */
+    uint64_t sgx_svn_status;       /* Intel with SGX */
+
+    /* GETSEC and the TXT public config registers */
+    bool                  txt_valid;
+    capabilities_t        getsec_caps;
+    getsec_parameters_t   getsec_params;
+    txt_didvid_t          didvid;
+    txt_ver_fsbif_qpiif_t ver;
+    uint64_t              sinit_base;
+    uint64_t              sinit_size;
+    uint64_t              heap_base;
+    uint64_t              heap_size;
+} platform_info_t;
+
+/* CPU vendors slexec tells apart */
+#define CPU_VENDOR_OTHER    0
+#define CPU_VENDOR_INTEL    1
+#define CPU_VENDOR_AMD      2
+
+extern void init_platform_info(void);
+extern void update_platform_feat_ctrl(void);
+extern const platform_info_t *get_platform_info(void);
+extern void print_platform_info(void);
+extern unsigned int get_cpu_vendor(void);
+extern uint32_t get_cpu_fms(void);
+
+#endif /* __PLATFORM_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -56,14 +56,52 @@ extern uint8_t g_vga_delay;
 extern serial_port_t g_com_port;
 
 #define serial_init()         comc_init()
-#define serial_write(s, n)    comc_puts(s, n)
 
-#define vga_write(s,n)        vga_puts(s, n)
+/*
+ * build-time maximum log levels, using the digit of the SLEXEC_* prefixes
+ * (0 = none ... 5 = all); messages more verbose than the maximum of the
+ * subsystem a file belongs to are compiled out.  a file selects its
+ * subsystem by defining SLEXEC_LOG_SUBSYS_MAX before including this file.
+ */
+#define SLEXEC_LOG_MAX_ALL       5
+
+#ifndef SLEXEC_LOG_MAX_DEFAULT
+#define SLEXEC_LOG_MAX_DEFAULT   SLEXEC_LOG_MAX_ALL
+#endif
+#ifndef SLEXEC_LOG_MAX_TPM
+#define SLEXEC_LOG_MAX_TPM       SLEXEC_LOG_MAX_ALL
+#endif
+#ifndef SLEXEC_LOG_MAX_TXT
+#define SLEXEC_LOG_MAX_TXT       SLEXEC_LOG_MAX_ALL
+#endif
+#ifndef SLEXEC_LOG_MAX_LOADER
+#define SLEXEC_LOG_MAX_LOADER    SLEXEC_LOG_MAX_ALL
+#endif
+#ifndef SLEXEC_LOG_MAX_E820
+#define SLEXEC_LOG_MAX_E820      SLEXEC_LOG_MAX_ALL
+#endif
+#ifndef SLEXEC_LOG_MAX_SKINIT
+#define SLEXEC_LOG_MAX_SKINIT    SLEXEC_LOG_MAX_ALL
+#endif
+
+#ifndef SLEXEC_LOG_SUBSYS_MAX
+#define SLEXEC_LOG_SUBSYS_MAX    SLEXEC_LOG_MAX_DEFAULT
+#endif
 
 extern void printk_init(void);
 extern void printk(const char *fmt, ...)
                          __attribute__ ((format (printf, 1, 2)));
 
+/* fmt is a literal in all callers, so this folds to a constant */
+#define printk_compiled_in(fmt) \
+    ((fmt)[0] != '<' || (fmt)[1] - '0' <= SLEXEC_LOG_SUBSYS_MAX)
+
+#define printk(fmt, ...)                                       \
+    do {                                                       \
+        if ( printk_compiled_in(fmt) )                         \
+            (printk)(fmt, ##__VA_ARGS__);                      \
+    } while (0)
+
 extern void print_hash(const sl_hash_t *hash, uint16_t hash_alg);
 extern void print_uuid(const uuid_t *uuid);
 
@@ -186,6 +186,9 @@ static always_inline uint32_t cpuid_edx(unsigned int op)
 #define CPUID_X86_EXT_FEATURE_LEAF      0x7 /* eax=7, ecx=0 */
 #define CPUID_X86_FEATURE_SGX           (1<<2)
 
+#define CPUID_X86_TSC_LEAF              0x15
+#define CPUID_X86_FREQ_LEAF             0x16
+
 #define CPUID_X86_EXT_FEATURE_INFO_LEAF 0x80000001
 #define CPUID_X86_EXT_FEATURE_SKINIT    (1<<12)
 
@@ -341,6 +344,11 @@ static inline void cpu_mwait(int extensions, int hints)
 #define SGX_SVN_STATUS_LOCK       (1<<0)
 #define SGX_SVN_STATUS_SINIT      (0xff<<16)
 
+/* TSC frequency discovery */
+#define MSR_PLATFORM_INFO         0x0ce
+#define MSR_AMD_PSTATE_DEF        0xc0010064
+#define AMD_PSTATE_EN             (1ULL<<63)
+
 /* MTRR handling */
 #define MSR_MTRRcap               0x0fe
 #define MSR_MTRRdefType           0x2ff
@@ -357,6 +365,7 @@ static inline void cpu_mwait(int extensions, int hints)
 
 #define LAPIC_ICR_LO_OFFSET       (0x300)
 #define ICR_MODE_INIT             (5<<8)
+#define ICR_DELIVERY_PENDING      (1<<12)
 #define ICR_DELIVER_EXCL_SELF     (3<<18)
 
 static inline uint64_t rdmsr(uint32_t msr)
@@ -374,6 +383,7 @@ static inline void wrmsr(uint32_t msr, uint64_t newval)
 
 #define readb(va)	(*(volatile uint8_t *) (va))
 #define readw(va)	(*(volatile uint16_t *) (va))
+#define readl(va)	(*(volatile uint32_t *) (va))
 
 #define writeb(va, d)	(*(volatile uint8_t *) (va) = (d))
 #define writew(va, d)	(*(volatile uint16_t *) (va) = (d))
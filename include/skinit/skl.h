@@ -35,6 +35,9 @@
 
 #define SKL_VERSION 0
 
+/* SKINIT takes a 64K aligned SLB of up to 64K */
+#define SKL_SLB_SIZE 0x10000
+
 #define SKINIT_SKL_UUID  {0x78f1268e, 0x0492, 0x11e9, 0x832a, \
                           {0xc8, 0x5b, 0x76, 0xc4, 0xcc, 0x03 }}
 
@@ -106,11 +109,12 @@ typedef struct __packed {
 } skl_tag_setup_indirect_t;
 
 extern sl_header_t *g_skl_module;
+extern void *g_skl_mod_start;
 extern uint32_t g_skl_size;
 
 extern bool is_skl_module(const void *skl_base, uint32_t skl_size);
 extern void print_skl_module(void);
-extern void relocate_skl_module(void);
+extern bool relocate_skl_module(void);
 extern bool prepare_skl_bootloader_data(void);
 
 #endif /* __SKINIT_SKL_H__ */
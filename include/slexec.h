@@ -88,13 +88,14 @@
 #define SLEXEC_MLEPT_PAGES_COVERED     (SLEXEC_MLEPT_PAGE_TABLES*512)
 #define SLEXEC_MLEPT_BYTES_COVERED     (SLEXEC_MLEPT_PAGES_COVERED*PAGE_SIZE)
 
+/* address/size for the boot phase timeline record */
+#define SLEXEC_TIMELINE_ADDR           (SLEXEC_MLEPT_ADDR + \
+                                        SLEXEC_MLEPT_SIZE)
+#define SLEXEC_TIMELINE_SIZE           0x1000
+
 /* Used as a basic cmdline buffer size for copying cmdlines */
 #define SLEXEC_KERNEL_CMDLINE_SIZE     0x0400
 
-/* TODO Fixed allocation values */
-#define SLEXEC_FIXED_INITRD_BASE       0x20000000
-#define SLEXEC_FIXED_SKL_BASE          0x40000000
-
 #define ENTRY(name)                             \
   .globl name;                                  \
   .align 16,0x90;                               \
@@ -47,6 +47,8 @@ int	 sl_strncmp(const char *, const char *, size_t);
 char	*sl_strncpy(char * __restrict, const char * __restrict, size_t);
 void	*sl_memcpy(void *dst, const void *src, size_t len);
 int	 sl_snprintf(char *buf, size_t size, const char *fmt, ...);
+typedef void (*sl_putc_t)(char ch, void *ctx);
+int	 sl_vcbprintf(sl_putc_t putc, void *ctx, const char *fmt, va_list ap);
 int	 sl_vscnprintf(char *buf, size_t size, const char *fmt, va_list ap);
 unsigned long sl_strtoul(const char *nptr, char **endptr, int base);
 
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+/* pre-launch boot phases, timed with the TSC */
+enum {
+    BOOT_PHASE_LOADER,          /* loader type detection */
+    BOOT_PHASE_CMDLINE,         /* cmdline parse and log init */
+    BOOT_PHASE_E820,            /* e820 copy */
+    BOOT_PHASE_TPM_DETECT,
+    BOOT_PHASE_SINIT,           /* SINIT discovery and copy */
+    BOOT_PHASE_ACM_VERIFY,
+    BOOT_PHASE_SKL,             /* SKL discovery and relocation */
+    BOOT_PHASE_TPM_INIT,
+    BOOT_PHASE_KERNEL,          /* kernel expansion */
+    BOOT_PHASE_PAGE_TABLE,      /* MLE page table build */
+    BOOT_PHASE_TXT_HEAP,
+    BOOT_PHASE_MTRRS,
+    BOOT_PHASE_LAUNCH,          /* up to GETSEC[SENTER]/SKINIT */
+    BOOT_PHASE_MAX
+};
+
+typedef struct __packed {
+    uint64_t   start;
+    uint64_t   end;
+} boot_phase_time_t;
+
+/*
+ * fixed memory record of the boot timeline; all times are raw TSC values,
+ * ticks_per_millisec is filled in when the summary is printed
+ */
+typedef struct __packed {
+    uuid_t              uuid;
+    uint32_t            nr_phases;
+    uint64_t            entry;
+    uint64_t            ticks_per_millisec;
+    boot_phase_time_t   phases[BOOT_PHASE_MAX];
+} slexec_timeline_t;
+
+/* {5B0F1E7C-8A4D-4E21-9C3B-6D2A17F0C845} */
+#define SLEXEC_TIMELINE_UUID {0x5b0f1e7c, 0x8a4d, 0x4e21, 0x9c3b, \
+                              {0x6d, 0x2a, 0x17, 0xf0, 0xc8, 0x45 }}
+
+extern void timeline_init(uint64_t entry);
+extern void timeline_start(unsigned int phase);
+extern void timeline_end(unsigned int phase);
+extern void timeline_record(unsigned int phase, uint64_t start, uint64_t end);
+extern void print_timeline(void);
+
+#endif /* __TIMELINE_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
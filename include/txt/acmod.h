@@ -175,6 +175,7 @@ extern uint32_t g_sinit_size;
 extern void print_txt_caps(const char *prefix, txt_caps_t caps);
 extern bool is_sinit_acmod(const void *acmod_base, uint32_t acmod_size, bool quiet);
 extern bool does_acmod_match_platform(const acm_hdr_t* hdr);
+extern bool is_acmod_newer(const acm_hdr_t *acm, const acm_hdr_t *than);
 extern acm_hdr_t *copy_sinit(const acm_hdr_t *sinit);
 extern bool verify_acmod(const acm_hdr_t *acm_hdr);
 extern uint32_t get_supported_os_sinit_data_ver(const acm_hdr_t* hdr);
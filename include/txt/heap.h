@@ -259,7 +259,6 @@ typedef struct __packed {
  *   - private to Secure Launch (so can be any format we need)
  */
 #define OS_MLE_STRUCT_VERSION    2
-#define MAX_EVENT_LOG_SIZE       (5*4*1024)   /* 4k*5 */
 
 typedef struct __packed {
     uint32_t version;
@@ -269,7 +268,6 @@ typedef struct __packed {
     uint32_t ap_wake_block;
     uint32_t ap_wake_block_size;
     uint8_t  mle_scratch[64];
-    uint8_t  event_log_buffer[MAX_EVENT_LOG_SIZE];
 } os_mle_data_t;
 
 #define MIN_OS_SINIT_DATA_VER    4
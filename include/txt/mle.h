@@ -72,6 +72,9 @@ typedef struct {
     uint32_t    cmdline_end_off;
 } mle_hdr_t;
 
+/* MLE page dir/table entry is phys addr + P */
+#define MAKE_PDTE(addr)  (((uint64_t)(unsigned long)(addr) & PAGE_MASK) | 0x01)
+
 #define MLE_HDR_UUID {0x9082ac5a, 0x476f, 0x74a7, 0x5c0f, \
                            {0x55, 0xa2, 0xcb, 0x51, 0xb6, 0x42}}
 
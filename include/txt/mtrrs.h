@@ -131,6 +131,7 @@ typedef struct __packed {
 } mtrr_state_t;
 
 extern bool set_mtrrs_for_acmod(const acm_hdr_t *hdr);
+extern bool verify_mtrrs_for_acmod(const acm_hdr_t *hdr);
 extern void save_mtrrs(mtrr_state_t *saved_state);
 extern void set_all_mtrrs(bool enable);
 
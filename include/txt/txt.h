@@ -288,7 +288,10 @@ extern void txt_display_errors(void);
 extern bool txt_has_error(void);
 extern int supports_txt(void);
 extern int txt_verify_platform(void);
+extern bool txt_prepare_pmrs(void);
+extern bool txt_alloc_event_log(void);
 extern int txt_launch_environment(loader_ctx *lctx);
+extern bool txt_verify_senter_setup(const void *mle_ptab);
 extern int txt_launch_racm(loader_ctx *lctx);
 extern void txt_post_launch(void);
 extern int txt_post_launch_verify_platform(void);
@@ -72,6 +72,7 @@
 
 
 void vga_init(void);
+void vga_putc(int c);
 void vga_puts(const char *s, unsigned int cnt);
 
 #endif /* __VGA_H__ */
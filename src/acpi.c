@@ -64,7 +64,7 @@ static inline struct acpi_xsdt *get_xsdt(void)
     return (struct acpi_xsdt *)(uintptr_t)rsdp->rsdp_xsdt;
 }
 
-static bool verify_acpi_checksum(uint8_t *start, uint8_t len)
+static bool verify_acpi_checksum(uint8_t *start, uint32_t len)
 {
     uint8_t sum = 0;
     while ( len ) {
@@ -74,31 +74,124 @@ static bool verify_acpi_checksum(uint8_t *start, uint8_t len)
     return (sum == 0);
 }
 
+static bool verify_rsdp(struct acpi_rsdp *candidate)
+{
+#define RSDP_CHKSUM_LEN  20  /* rsdp check sum length, defined in ACPI 1.0 */
+
+    if ( sl_memcmp(candidate->rsdp1.signature, RSDP_SIG,
+                   sizeof(candidate->rsdp1.signature)) != 0 )
+        return false;
+
+    if ( !verify_acpi_checksum((uint8_t *)candidate, RSDP_CHKSUM_LEN) ) {
+        printk(SLEXEC_ERR"checksum failed.\n");
+        return false;
+    }
+    if ( candidate->rsdp1.revision >= 2 &&
+         !verify_acpi_checksum((uint8_t *)candidate, candidate->rsdp_length) ) {
+        printk(SLEXEC_ERR"extended checksum failed.\n");
+        return false;
+    }
+
+    return true;
+}
+
 static bool find_rsdp_in_range(void *start, void *end)
 {
 #define RSDP_BOUNDARY    16  /* rsdp ranges on 16-byte boundaries */
-#define RSDP_CHKSUM_LEN  20  /* rsdp check sum length, defined in ACPI 1.0 */
 
     for ( ; start < end; start += RSDP_BOUNDARY ) {
-        rsdp = (struct acpi_rsdp *)start;
-
-        if ( sl_memcmp(rsdp->rsdp1.signature, RSDP_SIG,
-                    sizeof(rsdp->rsdp1.signature)) == 0 ) {
-            if ( verify_acpi_checksum((uint8_t *)rsdp, RSDP_CHKSUM_LEN) ) {
-                printk(SLEXEC_DETA"RSDP (v%u, %.6s) @ %p\n", rsdp->rsdp1.revision,
-                       rsdp->rsdp1.oemid, rsdp);
-                return true;
-            }
-            else {
-                printk(SLEXEC_ERR"checksum failed.\n");
-                return false;
-            }
-        }
+        struct acpi_rsdp *candidate = (struct acpi_rsdp *)start;
+
+        if ( sl_memcmp(candidate->rsdp1.signature, RSDP_SIG,
+                       sizeof(candidate->rsdp1.signature)) != 0 )
+            continue;
+        if ( !verify_rsdp(candidate) )
+            return false;
+
+        rsdp = candidate;
+        printk(SLEXEC_DETA"RSDP (v%u, %.6s) @ %p\n", rsdp->rsdp1.revision,
+               rsdp->rsdp1.oemid, rsdp);
+        return true;
     }
     return false;
 }
 
-static bool find_rsdp(void)
+/* look the RSDP up in the EFI system table's configuration tables */
+static bool find_rsdp_in_efi(loader_ctx *lctx)
+{
+    static const efi_guid_t acpi20_guid = ACPI_20_TABLE_GUID;
+    static const efi_guid_t acpi10_guid = ACPI_TABLE_GUID;
+    uint32_t systab32 = 0;
+    uint64_t systab64 = 0;
+    uint64_t nr_tables, tables;
+    uint32_t entry_size;
+    struct acpi_rsdp *acpi10 = NULL;
+
+    if ( !get_loader_efi_ptr(lctx, &systab32, &systab64) )
+        return false;
+
+    if ( systab64 != 0 ) {
+        struct efi_system_table64 *st;
+
+        if ( systab64 >= 0x100000000ULL ) {
+            printk(SLEXEC_ERR"EFI system table above 4GB\n");
+            return false;
+        }
+        st = (struct efi_system_table64 *)(uintptr_t)systab64;
+        if ( st->hdr.signature != EFI_SYSTEM_TABLE_SIGNATURE )
+            return false;
+        nr_tables = st->nr_tables;
+        tables = st->tables;
+        entry_size = sizeof(struct efi_config_table64);
+    }
+    else {
+        struct efi_system_table32 *st =
+            (struct efi_system_table32 *)(uintptr_t)systab32;
+
+        if ( st == NULL || st->hdr.signature != EFI_SYSTEM_TABLE_SIGNATURE )
+            return false;
+        nr_tables = st->nr_tables;
+        tables = st->tables;
+        entry_size = sizeof(struct efi_config_table32);
+    }
+
+    if ( tables == 0 || tables + nr_tables * entry_size > 0x100000000ULL )
+        return false;
+
+    for ( uint32_t i = 0; i < (uint32_t)nr_tables; i++ ) {
+        void *entry = (void *)(uintptr_t)tables + i * entry_size;
+        const efi_guid_t *guid = entry;
+        uint64_t table;
+
+        if ( systab64 != 0 )
+            table = ((struct efi_config_table64 *)entry)->table;
+        else
+            table = ((struct efi_config_table32 *)entry)->table;
+        if ( table == 0 || table >= 0x100000000ULL )
+            continue;
+
+        /* prefer the ACPI 2.0+ RSDP, which also gives us the XSDT */
+        if ( sl_memcmp(guid, &acpi20_guid, sizeof(*guid)) == 0 &&
+             verify_rsdp((struct acpi_rsdp *)(uintptr_t)table) ) {
+            rsdp = (struct acpi_rsdp *)(uintptr_t)table;
+            break;
+        }
+        if ( sl_memcmp(guid, &acpi10_guid, sizeof(*guid)) == 0 &&
+             verify_rsdp((struct acpi_rsdp *)(uintptr_t)table) )
+            acpi10 = (struct acpi_rsdp *)(uintptr_t)table;
+    }
+
+    if ( rsdp == NULL )
+        rsdp = acpi10;
+    if ( rsdp == NULL )
+        return false;
+
+    printk(SLEXEC_DETA"RSDP (v%u, %.6s) @ %p from EFI configuration table\n",
+           rsdp->rsdp1.revision, rsdp->rsdp1.oemid, rsdp);
+    return true;
+}
+
+static bool find_rsdp(loader_ctx *lctx)
 {
     uint32_t length;
     uint8_t *ldr_rsdp = NULL;
@@ -106,13 +199,21 @@ static bool find_rsdp(void)
     if ( rsdp != NULL )
         return true;
 
-    /* for grins, let's try asking the loader_ctx if it has a copy */
-    ldr_rsdp = get_loader_rsdp(g_ldr_ctx, &length);
-    if (ldr_rsdp != NULL){
+    /* our MB2 header asks the loader for a copy, so that comes first */
+    ldr_rsdp = get_loader_rsdp(lctx, &length);
+    if (ldr_rsdp != NULL && verify_rsdp((struct acpi_rsdp *) ldr_rsdp)){
         rsdp = (struct acpi_rsdp *) ldr_rsdp;
         return true;
     }
 
+    /* the legacy BIOS areas are no place to look for it on EFI */
+    if ( is_loader_launch_efi(lctx) ) {
+        if ( find_rsdp_in_efi(lctx) )
+            return true;
+        printk(SLEXEC_ERR"no RSDP from the EFI loader or configuration table\n");
+        return false;
+    }
+
     /*  0x00 - 0x400 */
     if ( find_rsdp_in_range(RSDP_SCOPE1_LOW, RSDP_SCOPE1_HIGH) )
         return true;
@@ -126,35 +227,15 @@ static bool find_rsdp(void)
     return false;
 }
 
-static struct acpi_rsdp
-*get_rsdp_internal(loader_ctx *lctx)
-{
-    if (find_rsdp())
-        return rsdp;
-
-    /* so far we're striking out. Must have been an EFI lauch */
-    if (!is_loader_launch_efi(lctx))
-        return NULL;
-
-    /* EFI launch, and the loader didn't grace us with an ACPI tag.
-     * We can try to find this the hard way, right?
-     */
-    return NULL;
-}
-
-/* TODO fix this mess. The problem is in the MBI code */
-/* Need to define efi_systable to get to config tables for this */
-/* See uint8_t *efi_get_rsdp(void) in efi_tboot */
-/* TODO rework all this, find RSDP using EFI system table too */
 struct acpi_rsdp g_rsdp;
 struct acpi_rsdp
 *get_rsdp(loader_ctx *lctx)
 {
     /* Only do this once and save a safe copy */
-    /* !HACK! if grow_mb2_tag is called before saving a copy of the RSDP, */
-    /* that call will corrupt the RSDP in the loader context (MBI) */
+    /* the RSDP may be in the bootloader's MBI, which the kernel can land */
+    /* on once rewrite_loader_ctx() has moved us to a new one */
     if (rsdp == NULL) {
-        if (get_rsdp_internal(lctx) == NULL)
+        if (!find_rsdp(lctx))
             return NULL;
         sl_memcpy((void *)&g_rsdp, rsdp, sizeof(struct acpi_rsdp));
         rsdp = &g_rsdp;
@@ -163,60 +244,193 @@ struct acpi_rsdp
     return rsdp;
 }
 
-/* this function can find dmar table whether or not it was hidden */
-static struct acpi_table_header *find_table(const char *table_name)
+/*
+ * index of the tables the XSDT (or RSDT) points to, built on first use so
+ * lookups don't walk the root table and checksum the tables every time
+ */
+#define MAX_ACPI_TABLES  64
+
+typedef struct {
+    uint8_t  signature[4];
+    uint32_t addr;
+    bool     checksum_ok;
+} acpi_table_entry_t;
+
+static acpi_table_entry_t g_acpi_tables[MAX_ACPI_TABLES];
+static unsigned int g_nr_acpi_tables;
+static bool g_acpi_indexed;
+
+static void index_table(uint64_t addr)
+{
+    struct acpi_table_header *table;
+    acpi_table_entry_t *entry;
+
+    if ( addr == 0 || addr >= 0x100000000ULL ) {
+        printk(SLEXEC_WARN"skipping ACPI table @ 0x%Lx\n", addr);
+        return;
+    }
+    if ( g_nr_acpi_tables == MAX_ACPI_TABLES ) {
+        printk(SLEXEC_WARN"too many ACPI tables, skipping 0x%Lx\n", addr);
+        return;
+    }
+
+    table = (struct acpi_table_header *)(uintptr_t)addr;
+    entry = &g_acpi_tables[g_nr_acpi_tables++];
+    sl_memcpy(entry->signature, table->signature, sizeof(entry->signature));
+    entry->addr = (uint32_t)addr;
+    entry->checksum_ok = verify_acpi_checksum((uint8_t *)table, table->length);
+
+    acpi_printk(SLEXEC_DETA"ACPI %.4s @ 0x%x, length 0x%x%s\n",
+                table->signature, entry->addr, table->length,
+                entry->checksum_ok ? "" : " (bad checksum)");
+    if ( !entry->checksum_ok )
+        printk(SLEXEC_WARN"ACPI %.4s @ 0x%x has a bad checksum\n",
+               table->signature, entry->addr);
+}
+
+static bool build_acpi_index(void)
 {
-    struct acpi_table_header *table = NULL;
     struct acpi_xsdt *xsdt = NULL;
     struct acpi_rsdt *rsdt;
 
+    if ( g_acpi_indexed )
+        return true;
+
     if ( get_rsdp(g_ldr_ctx) == NULL ) {
         printk(SLEXEC_ERR"no rsdp to use\n");
-        return NULL;
+        return false;
     }
 
-    if ( rsdp->rsdp_xsdt < 0x100000000ULL )
-        xsdt = (struct acpi_xsdt *)(uintptr_t)rsdp->rsdp_xsdt;
-    else
-        printk(SLEXEC_ERR"XSDT above 4GB\n");
+    if ( rsdp->rsdp1.revision >= 2 && rsdp->rsdp_xsdt != 0 )
+        xsdt = get_xsdt();
 
-    if ( rsdp->rsdp1.revision >= 2 && xsdt != NULL ) { /*  ACPI 2.0+ */
-        uint64_t first_table = (uint32_t)xsdt + sizeof(struct acpi_table_header);
-        for ( uint64_t *curr_table = (uint64_t *)(uint32_t)first_table;
-              curr_table < (uint64_t *)((void *)xsdt + xsdt->hdr.length);
-              curr_table++ ) {
-            table = (struct acpi_table_header *)(uintptr_t)*curr_table;
-            if ( sl_memcmp(table->signature, table_name,
-                           sizeof(table->signature)) == 0 )
-                return table;
-        }
+    if ( xsdt != NULL ) { /*  ACPI 2.0+ */
+        uint32_t nr = (xsdt->hdr.length - sizeof(struct acpi_table_header)) /
+                      sizeof(uint64_t);
+
+        if ( !verify_acpi_checksum((uint8_t *)xsdt, xsdt->hdr.length) )
+            printk(SLEXEC_WARN"XSDT has a bad checksum\n");
+        for ( uint32_t i = 0; i < nr; i++ )
+            index_table(xsdt->table_offsets[i]);
     }
     else { /* ACPI 1.0 */
-        rsdt = (struct acpi_rsdt *)rsdp->rsdp1.rsdt;
-        uint32_t first_table = (uint32_t)rsdt + sizeof(struct acpi_table_header);
+        uint32_t nr;
 
+        rsdt = (struct acpi_rsdt *)rsdp->rsdp1.rsdt;
         if ( rsdt == NULL ) {
             printk(SLEXEC_ERR"rsdt is invalid.\n");
-            return NULL;
+            return false;
         }
 
-        for ( uint32_t *curr_table = (uint32_t *)first_table;
-              curr_table < (uint32_t *)((void *)rsdt + rsdt->hdr.length);
-              curr_table++ ) {
-            table = (struct acpi_table_header *)(uintptr_t)*curr_table;
-            if ( sl_memcmp(table->signature, table_name,
-                           sizeof(table->signature)) == 0 )
-                return table;
+        if ( !verify_acpi_checksum((uint8_t *)rsdt, rsdt->hdr.length) )
+            printk(SLEXEC_WARN"RSDT has a bad checksum\n");
+        nr = (rsdt->hdr.length - sizeof(struct acpi_table_header)) /
+             sizeof(uint32_t);
+        for ( uint32_t i = 0; i < nr; i++ )
+            index_table(rsdt->table_offsets[i]);
+    }
+
+    printk(SLEXEC_DETA"indexed %u ACPI tables\n", g_nr_acpi_tables);
+    g_acpi_indexed = true;
+    return true;
+}
+
+/* first table with the given signature, NULL if absent or corrupt */
+struct acpi_table_header *get_acpi_table(const char *table_name)
+{
+    if ( !build_acpi_index() )
+        return NULL;
+
+    for ( unsigned int i = 0; i < g_nr_acpi_tables; i++ ) {
+        acpi_table_entry_t *entry = &g_acpi_tables[i];
+
+        if ( sl_memcmp(entry->signature, table_name,
+                       sizeof(entry->signature)) != 0 )
+            continue;
+        if ( !entry->checksum_ok ) {
+            printk(SLEXEC_ERR"not using %s table with bad checksum\n",
+                   table_name);
+            return NULL;
         }
+        return (struct acpi_table_header *)(uintptr_t)entry->addr;
     }
 
     printk(SLEXEC_ERR"can't find %s table.\n", table_name);
     return NULL;
 }
 
+/* I/O port of the ACPI PM timer, 0 if the platform has none */
+uint16_t get_acpi_pm_timer(bool *is_32bit)
+{
+    struct acpi_fadt *fadt = (struct acpi_fadt *)get_acpi_table(FADT_SIG);
+    uint64_t port;
+
+    if ( fadt == NULL )
+        return 0;
+
+    /* the extended block takes precedence when present */
+    port = fadt->pm_tmr_blk;
+    if ( fadt->hdr.length >= offsetof(struct acpi_fadt, x_pm_tmr_blk) +
+                             sizeof(fadt->x_pm_tmr_blk) &&
+         fadt->x_pm_tmr_blk.address_space_id == GAS_SYSTEM_IOSPACE &&
+         fadt->x_pm_tmr_blk.address != 0 )
+        port = fadt->x_pm_tmr_blk.address;
+
+    if ( port == 0 || port > 0xffff )
+        return 0;
+
+    *is_32bit = !!(fadt->flags & FADT_TMR_VAL_EXT);
+    return (uint16_t)port;
+}
+
+/*
+ * fill in up to <max> of the DMAR's RMRR regions as [base, limit) pairs
+ * returns the number of RMRRs the table reports, which may exceed <max>
+ */
+unsigned int get_dmar_rmrrs(uint64_t *bases, uint64_t *limits,
+                            unsigned int max)
+{
+    struct acpi_dmar *dmar = (struct acpi_dmar *)get_acpi_table(DMAR_SIG);
+    unsigned int nr = 0;
+    uint8_t *curr, *end;
+
+    if ( dmar == NULL )
+        return 0;
+
+    curr = (uint8_t *)dmar->table_offsets;
+    end = (uint8_t *)dmar + dmar->hdr.length;
+    while ( curr + offsetof(struct dmar_remapping, flags) <= end ) {
+        struct dmar_remapping *entry = (struct dmar_remapping *)curr;
+
+        if ( entry->length < offsetof(struct dmar_remapping, flags) ||
+             curr + entry->length > end ) {
+            printk(SLEXEC_WARN"malformed DMAR remapping structure at 0x%x\n",
+                   (uint32_t)curr);
+            break;
+        }
+
+        if ( entry->type == DMAR_REMAPPING_RMRR &&
+             entry->length >= offsetof(struct dmar_rmrr, device_scope_entry) ) {
+            struct dmar_rmrr *rmrr = (struct dmar_rmrr *)curr;
+
+            printk(SLEXEC_DETA"DMAR RMRR: 0x%Lx - 0x%Lx\n",
+                   rmrr->base_address, rmrr->limit_address);
+            if ( nr < max ) {
+                bases[nr] = rmrr->base_address;
+                limits[nr] = rmrr->limit_address + 1;
+            }
+            nr++;
+        }
+
+        curr += entry->length;
+    }
+
+    return nr;
+}
+
 bool vtd_bios_enabled(void)
 {
-    return !!(find_table(DMAR_SIG) != NULL);
+    return !!(get_acpi_table(DMAR_SIG) != NULL);
 }
 
 /*
@@ -72,7 +72,7 @@ static const cmdline_option_t g_slexec_cmdline_options[] = {
     /* serial=<baud>[/<clock_hz>][,<DPS>[,<io-base>[,<irq>[,<serial-bdf>[,<bridge-bdf>]]]]] */
     { "vga_delay",  "0" },           /* # secs */
     { "pcr_map", "legacy" },         /* legacy|da */
-    { "min_ram", "0" },              /* size in bytes | 0 for no min */
+    { "evtlog_events", "64" },       /* # of extra DRTM event log entries */
     { "ignore_prev_err", "true"},    /* true|false */
     { "error_shutdown", "halt"},     /* shutdown|reboot|halt */
     { NULL, NULL }
@@ -176,17 +176,16 @@ void linux_parse_cmdline(const char *cmdline)
     cmdline_parse(cmdline, g_linux_cmdline_options, g_linux_param_values);
 }
 
-uint8_t get_loglvl_prefix(char **pbuf, int *len)
+uint8_t get_loglvl_prefix(const char **pfmt)
 {
     uint8_t log_level = SLEXEC_LOG_LEVEL_ALL;
+    const char *fmt = *pfmt;
 
-    if ( *len > 2 && **pbuf == '<' && *(*pbuf+2) == '>'
-                  && isdigit(*(*pbuf+1)) ) {
-        unsigned int i = *(*pbuf+1) - '0';
+    if ( fmt[0] == '<' && isdigit(fmt[1]) && fmt[2] == '>' ) {
+        unsigned int i = fmt[1] - '0';
         if ( i < ARRAY_SIZE(g_loglvl_map) )
             log_level = g_loglvl_map[i].log_val;
-        *pbuf += 3;
-        *len = *len - 3;
+        *pfmt += 3;
     }
 
     return log_level;
@@ -447,14 +446,14 @@ bool get_slexec_prefer_da(void)
     return false;
 }
 
-uint32_t get_slexec_min_ram(void)
+uint32_t get_slexec_evtlog_events(void)
 {
-    const char *min_ram = get_option_val(g_slexec_cmdline_options,
-                                         g_slexec_param_values, "min_ram");
-    if ( min_ram == NULL )
-        return 0; /* default */
+    const char *events = get_option_val(g_slexec_cmdline_options,
+                                        g_slexec_param_values, "evtlog_events");
+    if ( events == NULL )
+        return 64; /* default */
 
-    return sl_strtoul(min_ram, NULL, 0);
+    return sl_strtoul(events, NULL, 0);
 }
 
 bool get_ignore_prev_err(void)
@@ -109,13 +109,17 @@ void comc_init(void)
     comc_setup(g_com_port.comc_curspeed);
 }
 
+void comc_putc(char c)
+{
+    if ( c == '\n' )
+        comc_putchar('\r');
+    comc_putchar(c);
+}
+
 void comc_puts(const char *s, unsigned int cnt)
 {
-    while ( *s && cnt-- ) {
-        if ( *s == '\n' )
-            comc_putchar('\r');
-        comc_putchar(*s++);
-    }
+    while ( *s && cnt-- )
+        comc_putc(*s++);
 }
 
 /*
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_E820
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -41,13 +43,20 @@
 #include <string.h>
 #include <loader.h>
 #include <stdarg.h>
+#include <processor.h>
 #include <e820.h>
+#include <acpi.h>
 
 /*
  * copy of bootloader/BIOS e820 table with adjusted entries
  * this version will replace original in mbi
  */
 #define MAX_E820_ENTRIES      (SLEXEC_E820_COPY_SIZE / sizeof(memory_map_t))
+
+/* VT-d PMR granularity and the most DMAR RMRRs we will honour */
+#define PMR_ALIGN             0x200000ULL
+#define MAX_RMRRS             32
+
 static unsigned int g_nr_map;
 static memory_map_t *g_copy_e820_map = (memory_map_t *)SLEXEC_E820_COPY_ADDR;
 
@@ -94,139 +103,338 @@ static void print_map(memory_map_t *e820, int nr_map)
     }
 }
 
-static bool insert_after_region(memory_map_t *e820map, unsigned int *nr_map,
-                                unsigned int pos, uint64_t addr, uint64_t size,
-                                uint32_t type)
+static inline uint64_t e820_end_64(memory_map_t *entry)
 {
-    /* no more room */
-    if ( *nr_map + 1 > MAX_E820_ENTRIES )
-        return false;
+    return e820_base_64(entry) + e820_length_64(entry);
+}
 
-    /* shift (copy) everything up one entry */
-    for ( unsigned int i = *nr_map - 1; i > pos; i--)
-        e820map[i+1] = e820map[i];
+static void set_entry(memory_map_t *entry, uint64_t addr, uint64_t size,
+                      uint32_t type)
+{
+    split64b(addr, &entry->base_addr_low, &entry->base_addr_high);
+    split64b(size, &entry->length_low, &entry->length_high);
+    entry->type = type;
+    entry->size = sizeof(memory_map_t) - sizeof(uint32_t);
+}
 
-    /* now add our entry */
-    split64b(addr, &(e820map[pos+1].base_addr_low),
-             &(e820map[pos+1].base_addr_high));
-    split64b(size, &(e820map[pos+1].length_low),
-             &(e820map[pos+1].length_high));
-    e820map[pos+1].type = type;
-    e820map[pos+1].size = sizeof(memory_map_t) - sizeof(uint32_t);
+/* memory the kernel may use, though boot services data can still be in use */
+static bool is_ram_type(uint32_t type)
+{
+    return type == E820_RAM || type == E820_EFI_BOOT;
+}
 
-    (*nr_map)++;
+/*
+ * the map is kept sorted by base address with no overlapping entries, so
+ * both the bases and the ends of the entries are increasing
+ */
 
-    return true;
+/* index of the first entry ending above addr (nr_map if none) */
+static unsigned int first_ending_above(memory_map_t *e820map,
+                                       unsigned int nr_map, uint64_t addr)
+{
+    unsigned int lo = 0, hi = nr_map;
+
+    while ( lo < hi ) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if ( e820_end_64(&e820map[mid]) > addr )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
 }
 
-static void remove_region(memory_map_t *e820map, unsigned int *nr_map,
-                          unsigned int pos)
+/* index of the first entry starting at or above addr (nr_map if none) */
+static unsigned int first_starting_at(memory_map_t *e820map,
+                                      unsigned int nr_map, uint64_t addr)
 {
-    /* shift (copy) everything down one entry */
-    for ( unsigned int i = pos; i < *nr_map - 1; i++)
-        e820map[i] = e820map[i+1];
+    unsigned int lo = 0, hi = nr_map;
+
+    while ( lo < hi ) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if ( e820_base_64(&e820map[mid]) >= addr )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* merge entry pos into its predecessor if they touch and have one type */
+static bool merge_with_prev(memory_map_t *e820map, unsigned int *nr_map,
+                            unsigned int pos)
+{
+    memory_map_t *prev, *cur;
 
+    if ( pos == 0 || pos >= *nr_map )
+        return false;
+
+    prev = &e820map[pos - 1];
+    cur = &e820map[pos];
+    if ( prev->type != cur->type || e820_end_64(prev) != e820_base_64(cur) )
+        return false;
+    /* get_ram_ranges() wants low and high RAM in separate entries */
+    if ( e820_base_64(cur) == 0x100000000ULL )
+        return false;
+
+    set_entry(prev, e820_base_64(prev),
+              e820_length_64(prev) + e820_length_64(cur), prev->type);
+    sl_memmove(cur, cur + 1, (*nr_map - pos - 1) * sizeof(*cur));
     (*nr_map)--;
+
+    return true;
 }
 
+/*
+ * make [new_addr, new_addr + new_size) of type new_type, clipping or
+ * splitting whatever it overlaps; the entries after it are moved once
+ */
 static bool protect_region(memory_map_t *e820map, unsigned int *nr_map,
                            uint64_t new_addr, uint64_t new_size,
                            uint32_t new_type)
 {
-    uint64_t addr, tmp_addr, size, tmp_size;
-    uint32_t type;
-    unsigned int i;
+    uint64_t new_end = new_addr + new_size;
+    memory_map_t pieces[3];
+    unsigned int lo, hi, nr_pieces = 0, pos;
 
     if ( new_size == 0 )
         return true;
     /* check for wrap */
-    if ( new_addr + new_size < new_addr )
+    if ( new_end < new_addr )
         return false;
 
-    /* find where our region belongs in the table and insert it */
-    for ( i = 0; i < *nr_map; i++ ) {
-        addr = e820_base_64(&e820map[i]);
-        size = e820_length_64(&e820map[i]);
-        type = e820map[i].type;
-        /* is our region at the beginning of the current map region? */
-        if ( new_addr == addr ) {
-            if ( !insert_after_region(e820map, nr_map, i-1, new_addr, new_size,
-                                      new_type) )
-                return false;
-            break;
-        }
-        /* are we w/in the current map region? */
-        else if ( new_addr > addr && new_addr < (addr + size) ) {
-            if ( !insert_after_region(e820map, nr_map, i, new_addr, new_size,
-                                      new_type) )
-                return false;
-            /* fixup current region */
-            tmp_addr = e820_base_64(&e820map[i]);
-            split64b(new_addr - tmp_addr, &(e820map[i].length_low),
-                     &(e820map[i].length_high));
-            i++;   /* adjust to always be that of our region */
-            /* insert a copy of current region (before adj) after us so */
-            /* that rest of code can be common with previous case */
-            if ( !insert_after_region(e820map, nr_map, i, addr, size, type) )
-                return false;
-            break;
-        }
-        /* is our region in a gap in the map? */
-        else if ( addr > new_addr ) {
-            if ( !insert_after_region(e820map, nr_map, i-1, new_addr, new_size,
-                                      new_type) )
+    /* entries [lo, hi) overlap the new region */
+    lo = first_ending_above(e820map, *nr_map, new_addr);
+    hi = first_starting_at(e820map, *nr_map, new_end);
+
+    /* part of the first overlapped entry below us survives */
+    if ( lo < hi && e820_base_64(&e820map[lo]) < new_addr )
+        set_entry(&pieces[nr_pieces++], e820_base_64(&e820map[lo]),
+                  new_addr - e820_base_64(&e820map[lo]), e820map[lo].type);
+    pos = lo + nr_pieces;
+    set_entry(&pieces[nr_pieces++], new_addr, new_size, new_type);
+    /* part of the last overlapped entry above us survives */
+    if ( lo < hi && e820_end_64(&e820map[hi-1]) > new_end )
+        set_entry(&pieces[nr_pieces++], new_end,
+                  e820_end_64(&e820map[hi-1]) - new_end, e820map[hi-1].type);
+
+    /* no more room */
+    if ( *nr_map - (hi - lo) + nr_pieces > MAX_E820_ENTRIES )
+        return false;
+
+    sl_memmove(&e820map[lo + nr_pieces], &e820map[hi],
+               (*nr_map - hi) * sizeof(*e820map));
+    sl_memcpy(&e820map[lo], pieces, nr_pieces * sizeof(*e820map));
+    *nr_map = *nr_map - (hi - lo) + nr_pieces;
+
+    /* keep the map minimal */
+    merge_with_prev(e820map, nr_map, pos + 1);
+    merge_with_prev(e820map, nr_map, pos);
+
+    return true;
+}
+
+/* order of firmware entry a vs. b: by base, then by position in the map */
+static bool entry_before(memory_map_t **entries, uint16_t a, uint16_t b)
+{
+    uint64_t base_a = e820_base_64(entries[a]);
+    uint64_t base_b = e820_base_64(entries[b]);
+
+    return base_a < base_b || (base_a == base_b && a < b);
+}
+
+static void sift_down(memory_map_t **entries, uint16_t *idx,
+                      unsigned int root, unsigned int nr)
+{
+    while ( 2 * root + 1 < nr ) {
+        unsigned int child = 2 * root + 1;
+        uint16_t tmp;
+
+        if ( child + 1 < nr &&
+             entry_before(entries, idx[child], idx[child + 1]) )
+            child++;
+        if ( !entry_before(entries, idx[root], idx[child]) )
+            return;
+        tmp = idx[root];
+        idx[root] = idx[child];
+        idx[child] = tmp;
+        root = child;
+    }
+}
+
+/* heapsort the firmware entries (by index) into address order */
+static void sort_entries(memory_map_t **entries, uint16_t *idx,
+                         unsigned int nr)
+{
+    for ( unsigned int i = nr / 2; i-- > 0; )
+        sift_down(entries, idx, i, nr);
+    for ( unsigned int end = nr; end-- > 1; ) {
+        uint16_t tmp = idx[0];
+        idx[0] = idx[end];
+        idx[end] = tmp;
+        sift_down(entries, idx, 0, end);
+    }
+}
+
+/*
+ * build a map from nr unordered firmware entries: sort them once, then
+ * append them in a single pass, merging touching entries of the same type;
+ * if any of them overlap, the later one in firmware order has to win, so
+ * then they are all inserted through protect_region() in firmware order
+ */
+static bool build_map(memory_map_t *map, unsigned int *nr_map,
+                      memory_map_t **entries, unsigned int nr)
+{
+    static uint16_t idx[MAX_E820_ENTRIES];
+    uint64_t end = 0;
+    bool overlap = false;
+
+    if ( nr > MAX_E820_ENTRIES )
+        return false;
+
+    for ( unsigned int i = 0; i < nr; i++ ) {
+        uint64_t base = e820_base_64(entries[i]);
+
+        if ( base + e820_length_64(entries[i]) < base )
+            return false;
+        idx[i] = i;
+    }
+    sort_entries(entries, idx, nr);
+
+    for ( unsigned int i = 0; i < nr && !overlap; i++ ) {
+        memory_map_t *entry = entries[idx[i]];
+        uint64_t length = e820_length_64(entry);
+
+        if ( length == 0 )
+            continue;
+        overlap = e820_base_64(entry) < end;
+        if ( e820_base_64(entry) + length > end )
+            end = e820_base_64(entry) + length;
+    }
+
+    *nr_map = 0;
+    for ( unsigned int i = 0; i < nr; i++ ) {
+        memory_map_t *entry = entries[overlap ? i : idx[i]];
+        uint64_t base = e820_base_64(entry);
+        uint64_t length = e820_length_64(entry);
+
+        if ( length == 0 )
+            continue;
+
+        if ( overlap ) {
+            if ( !protect_region(map, nr_map, base, length, entry->type) )
                 return false;
-            break;
+            continue;
         }
+
+        set_entry(&map[(*nr_map)++], base, length, entry->type);
+        merge_with_prev(map, nr_map, *nr_map - 1);
     }
-    /* if we reached the end of the map without finding an overlapping */
-    /* region, insert us at the end (note that this test won't trigger */
-    /* for the second case above because the insert() will have incremented */
-    /* nr_map and so i++ will still be less) */
-    if ( i == *nr_map ) {
-        if ( !insert_after_region(e820map, nr_map, i-1, new_addr, new_size,
-                                  new_type) )
-            return false;
-        return true;
+
+    return true;
+}
+
+/*
+ * the EFI memory map in the same form as the e820 copy; it is only used
+ * for our own placement decisions and never handed on, so firmware
+ * memory that an e820 map lumps in with RAM or reserved keeps its own type
+ */
+static memory_map_t g_efi_map[MAX_E820_ENTRIES];
+static unsigned int g_nr_efi_map;
+
+static uint32_t efi_to_e820_type(efi_memory_desc_t *desc)
+{
+    if ( desc->attribute & EFI_MEMORY_RUNTIME )
+        return E820_EFI_RUNTIME;
+
+    switch ( desc->type ) {
+        case EFI_CONVENTIONAL_MEMORY:
+            return E820_RAM;
+        case EFI_LOADER_CODE:
+        case EFI_LOADER_DATA:
+        case EFI_BOOT_SERVICES_CODE:
+        case EFI_BOOT_SERVICES_DATA:
+            return E820_EFI_BOOT;
+        case EFI_RUNTIME_SERVICES_CODE:
+        case EFI_RUNTIME_SERVICES_DATA:
+            return E820_EFI_RUNTIME;
+        case EFI_ACPI_RECLAIM_MEMORY:
+            return E820_ACPI;
+        case EFI_ACPI_MEMORY_NVS:
+            return E820_NVS;
+        case EFI_UNUSABLE_MEMORY:
+            return E820_UNUSABLE;
+        case EFI_PERSISTENT_MEMORY:
+            return E820_PMEM;
+        default:
+            return E820_RESERVED;
     }
+}
 
-    i++;     /* move to entry after our inserted one (we're not at end yet) */
+/*
+ * copy_efi_map
+ *
+ * Converts the EFI memory map passed by the bootloader (if any); when it
+ * does not fit, g_nr_efi_map stays 0 and the e820 map is used instead
+ *
+ * return:  false = error (bad descriptors)
+ */
+static bool copy_efi_map(loader_ctx *lctx, memory_map_t **entries)
+{
+    static memory_map_t efi_entries[MAX_E820_ENTRIES];
+    uint32_t efi_mmap, descr_size, descr_vers, mmap_size;
+    unsigned int nr_entries = 0;
 
-    tmp_addr = e820_base_64(&e820map[i]);
-    tmp_size = e820_length_64(&e820map[i]);
+    g_nr_efi_map = 0;
 
-    /* did we split the (formerly) previous region? */
-    if ( (new_addr >= tmp_addr) &&
-         ((new_addr + new_size) < (tmp_addr + tmp_size)) ) {
-        /* then adjust the current region (adj size first) */
-        split64b((tmp_addr + tmp_size) - (new_addr + new_size),
-                 &(e820map[i].length_low), &(e820map[i].length_high));
-        split64b(new_addr + new_size,
-                 &(e820map[i].base_addr_low), &(e820map[i].base_addr_high));
+    efi_mmap = find_efi_memmap(lctx, &descr_size, &descr_vers, &mmap_size);
+    if ( efi_mmap == 0 )
         return true;
+    if ( descr_size < sizeof(efi_memory_desc_t) ) {
+        printk(SLEXEC_ERR"EFI memory descriptor size 0x%x too small\n",
+               descr_size);
+        return false;
     }
 
-    /* if our region completely covers any existing regions, delete them */
-    while ( (i < *nr_map) && ((new_addr + new_size) >=
-                              (tmp_addr + tmp_size)) ) {
-        remove_region(e820map, nr_map, i);
-        tmp_addr = e820_base_64(&e820map[i]);
-        tmp_size = e820_length_64(&e820map[i]);
-    }
+    for ( uint32_t off = 0; off + descr_size <= mmap_size;
+          off += descr_size ) {
+        efi_memory_desc_t *desc = (efi_memory_desc_t *)(efi_mmap + off);
+        uint64_t length = desc->num_pages << EFI_PAGE_SHIFT;
+        uint32_t type = efi_to_e820_type(desc);
+
+        /*
+         * firmware hands out far more descriptors than e820 entries, most
+         * of them runs of the same type, so fold those together
+         */
+        if ( nr_entries > 0 ) {
+            memory_map_t *prev = &efi_entries[nr_entries - 1];
+
+            if ( prev->type == type &&
+                 e820_base_64(prev) + e820_length_64(prev) == desc->phys_addr ) {
+                set_entry(prev, e820_base_64(prev),
+                          e820_length_64(prev) + length, type);
+                continue;
+            }
+        }
 
-    /* finally, if our region partially overlaps an existing region, */
-    /* then truncate the existing region */
-    if ( i < *nr_map ) {
-        tmp_addr = e820_base_64(&e820map[i]);
-        tmp_size = e820_length_64(&e820map[i]);
-        if ( (new_addr + new_size) > tmp_addr ) {
-            split64b((tmp_addr + tmp_size) - (new_addr + new_size),
-                        &(e820map[i].length_low), &(e820map[i].length_high));
-            split64b(new_addr + new_size, &(e820map[i].base_addr_low),
-                        &(e820map[i].base_addr_high));
+        if ( nr_entries == MAX_E820_ENTRIES ) {
+            printk(SLEXEC_WARN"too many EFI memory descriptors, "
+                   "using the e820 map instead\n");
+            return true;
         }
+        set_entry(&efi_entries[nr_entries], desc->phys_addr, length, type);
+        entries[nr_entries] = &efi_entries[nr_entries];
+        nr_entries++;
+    }
+
+    if ( !build_map(g_efi_map, &g_nr_efi_map, entries, nr_entries) ) {
+        printk(SLEXEC_ERR"failed to build EFI memory map\n");
+        return false;
     }
 
+    printk(SLEXEC_DETA"EFI memory map:\n");
+    print_map(g_efi_map, g_nr_efi_map);
+
     return true;
 }
 
@@ -250,6 +458,8 @@ unsigned int get_nr_map()
  */
 bool copy_e820_map(loader_ctx *lctx)
 {
+    static memory_map_t *entries[MAX_E820_ENTRIES];
+
     g_nr_map = 0;
 
     if (have_loader_memmap(lctx)){
@@ -258,22 +468,20 @@ bool copy_e820_map(loader_ctx *lctx)
         printk(SLEXEC_ERR"original e820 map:\n");
         print_map(memmap, memmap_length/sizeof(memory_map_t));
 
+        unsigned int nr_entries = 0;
         uint32_t entry_offset = 0;
 
-        while ( entry_offset < memmap_length &&
-                g_nr_map < MAX_E820_ENTRIES ) {
-            memory_map_t *entry = (memory_map_t *)
+        while ( entry_offset < memmap_length ) {
+            if ( nr_entries == MAX_E820_ENTRIES ) {
+                printk(SLEXEC_ERR"Too many e820 entries\n");
+                return false;
+            }
+            entries[nr_entries++] = (memory_map_t *)
                 (((uint32_t) memmap) + entry_offset);
 
-            /* we want to support unordered and/or overlapping entries */
-            /* so use protect_region() to insert into existing map, since */
-            /* it handles these cases */
-            if ( !protect_region(g_copy_e820_map, &g_nr_map,
-                                 e820_base_64(entry), e820_length_64(entry),
-                                 entry->type) )
-                return false;
             if (lctx->type == 1)
-                entry_offset += entry->size + sizeof(entry->size);
+                entry_offset += entries[nr_entries-1]->size +
+                                sizeof(entries[nr_entries-1]->size);
             if (lctx->type == 2)
                 /* the MB2 memory map entries don't have a size--
                  * they have a "zero" with a value of zero. Additionally,
@@ -281,10 +489,11 @@ bool copy_e820_map(loader_ctx *lctx)
                  * with a size, we get into trouble if we try to use them,
                  */
                 entry_offset += sizeof(memory_map_t);
-
         }
-        if ( g_nr_map == MAX_E820_ENTRIES ) {
-            printk(SLEXEC_ERR"Too many e820 entries\n");
+
+        /* we want to support unordered and/or overlapping entries */
+        if ( !build_map(g_copy_e820_map, &g_nr_map, entries, nr_entries) ) {
+            printk(SLEXEC_ERR"failed to build e820 map\n");
             return false;
         }
     }
@@ -316,6 +525,9 @@ bool copy_e820_map(loader_ctx *lctx)
         return false;
     }
 
+    if ( lctx->type == 2 && !copy_efi_map(lctx, entries) )
+        return false;
+
     return true;
 }
 
@@ -338,9 +550,8 @@ void print_e820_map(void)
  */
 static bool e820_reserve_ram(uint64_t base, uint64_t length)
 {
-    memory_map_t* e820_entry;
-    uint64_t e820_base, e820_length, e820_end;
     uint64_t end;
+    unsigned int i;
 
     if ( length == 0 )
         return true;
@@ -348,172 +559,232 @@ static bool e820_reserve_ram(uint64_t base, uint64_t length)
     end = base + length;
 
     /* find where our region should cover the ram in e820 */
-    for ( unsigned int i = 0; i < g_nr_map; i++ ) {
-        e820_entry = &g_copy_e820_map[i];
-        e820_base = e820_base_64(e820_entry);
-        e820_length = e820_length_64(e820_entry);
-        e820_end = e820_base + e820_length;
+    i = first_ending_above(g_copy_e820_map, g_nr_map, base);
+    while ( i < g_nr_map && e820_base_64(&g_copy_e820_map[i]) < end ) {
+        memory_map_t *e820_entry = &g_copy_e820_map[i];
+        uint64_t e820_base = e820_base_64(e820_entry);
+        uint64_t e820_end = e820_end_64(e820_entry);
+        uint64_t start, stop;
 
         /* if not ram, no need to deal with */
-        if ( e820_entry->type != E820_RAM )
+        if ( e820_entry->type != E820_RAM ) {
+            i++;
             continue;
+        }
+
+        /* reserve the part of the ram range that is within the range */
+        start = ( e820_base > base ) ? e820_base : base;
+        stop = ( e820_end < end ) ? e820_end : end;
+        if ( !protect_region(g_copy_e820_map, &g_nr_map, start, stop - start,
+                             E820_RESERVED) )
+            return false;
+        i = first_ending_above(g_copy_e820_map, g_nr_map, stop);
+    }
+
+    return true;
+}
+
+/* how much RAM in <map> lies within [start, end) */
+static uint64_t ram_in_range(memory_map_t *map, unsigned int nr_map,
+                             uint64_t start, uint64_t end)
+{
+    uint64_t total = 0;
+
+    for ( unsigned int i = 0; i < nr_map; i++ ) {
+        uint64_t base = e820_base_64(&map[i]);
+        uint64_t limit = base + e820_length_64(&map[i]);
 
-        /* if the range is before the current ram range, skip the ram range */
-        if ( end <= e820_base )
+        if ( !is_ram_type(map[i].type) || limit <= start || base >= end )
             continue;
-        /* if the range is after the current ram range, skip the ram range */
-        if ( base >= e820_end )
+        if ( base < start )
+            base = start;
+        if ( limit > end )
+            limit = end;
+        total += limit - base;
+    }
+
+    return total;
+}
+
+/*
+ * shrink the PMR window [*base, *limit) until no RMRR overlaps it, keeping
+ * whichever side of each RMRR holds more RAM; PMRs are 2M granular so the
+ * window edges stay 2M aligned
+ * [keep_base, keep_limit) has to stay inside the window, so an RMRR may only
+ * cut the window on the side that leaves it alone
+ * RMRRs below 1MB are ignored, as the legacy regions they cover are fine to
+ * DMA protect
+ */
+static bool exclude_rmrrs(memory_map_t *map, unsigned int nr_map,
+                          const uint64_t *rmrr_base,
+                          const uint64_t *rmrr_limit, unsigned int nr_rmrrs,
+                          uint64_t keep_base, uint64_t keep_limit,
+                          uint64_t *base, uint64_t *limit)
+{
+    for ( unsigned int i = 0; i < nr_rmrrs && *base < *limit; i++ ) {
+        uint64_t new_base, new_limit;
+        bool can_raise, can_lower;
+
+        if ( rmrr_limit[i] <= 0x100000ULL )
+            continue;
+        if ( rmrr_limit[i] <= *base || rmrr_base[i] >= *limit )
             continue;
 
-        /* case 1: the current ram range is within the range:
-           base, e820_base, e820_end, end */
-        if ( (base <= e820_base) && (e820_end <= end) )
-            e820_entry->type = E820_RESERVED;
-        /* case 2: overlapping:
-           base, e820_base, end, e820_end */
-        else if ( (e820_base >= base) && (end > e820_base) &&
-                  (e820_end > end) ) {
-            /* split the current ram map */
-            if ( !insert_after_region(g_copy_e820_map, &g_nr_map, i-1,
-                                      e820_base, (end - e820_base),
-                                      E820_RESERVED) )
-                return false;
-            /* fixup the current ram map */
-            i++;
-            split64b(end, &(g_copy_e820_map[i].base_addr_low),
-                     &(g_copy_e820_map[i].base_addr_high));
-            split64b(e820_end - end, &(g_copy_e820_map[i].length_low),
-                     &(g_copy_e820_map[i].length_high));
-            /* no need to check more */
-            break;
-        }
-        /* case 3: overlapping:
-           e820_base, base, e820_end, end */
-        else if ( (base > e820_base) && (e820_end > base) &&
-                  (end >= e820_end) ) {
-            /* fixup the current ram map */
-            split64b((base - e820_base), &(g_copy_e820_map[i].length_low),
-                     &(g_copy_e820_map[i].length_high));
-            /* split the current ram map */
-            if ( !insert_after_region(g_copy_e820_map, &g_nr_map, i, base,
-                                      (e820_end - base), E820_RESERVED) )
-                return false;
-            i++;
-        }
-        /* case 4: the range is within the current ram range:
-           e820_base, base, end, e820_end */
-        else if ( (base > e820_base) && (e820_end > end) ) {
-            /* fixup the current ram map */
-            split64b((base - e820_base), &(g_copy_e820_map[i].length_low),
-                     &(g_copy_e820_map[i].length_high));
-            /* split the current ram map */
-            if ( !insert_after_region(g_copy_e820_map, &g_nr_map, i, base,
-                                      length, E820_RESERVED) )
-                return false;
-            i++;
-            /* fixup the rest of the current ram map */
-            if ( !insert_after_region(g_copy_e820_map, &g_nr_map, i, end,
-                                      (e820_end - end), e820_entry->type) )
-                return false;
-            i++;
-            /* no need to check more */
-            break;
-        }
-        else {
-            printk(SLEXEC_ERR"we should never get here\n");
+        new_base = (rmrr_limit[i] + PMR_ALIGN - 1) & ~(PMR_ALIGN - 1);
+        new_limit = rmrr_base[i] & ~(PMR_ALIGN - 1);
+        can_raise = new_base <= keep_base;
+        can_lower = new_limit >= keep_limit;
+        if ( !can_raise && !can_lower ) {
+            printk(SLEXEC_ERR"RMRR 0x%Lx - 0x%Lx overlaps slexec memory\n",
+                   rmrr_base[i], rmrr_limit[i]);
             return false;
         }
+
+        if ( can_raise &&
+             (!can_lower ||
+              ram_in_range(map, nr_map, rmrr_limit[i], *limit) >
+              ram_in_range(map, nr_map, *base, rmrr_base[i])) )
+            *base = new_base;
+        else
+            *limit = new_limit;
+
+        if ( *limit < *base )
+            *limit = *base;
     }
 
     return true;
 }
 
+/*
+ * RAM that ends up outside the PMRs is left unprotected until the kernel
+ * sets up VT-d, so take it away from the kernel and from our own
+ * allocations instead; the first 1MB is left alone since the kernel needs
+ * it for its real-mode trampolines
+ */
+static bool reserve_unprotected_ram(uint64_t base, uint64_t limit)
+{
+    if ( base < 0x100000ULL )
+        base = 0x100000ULL;
+    if ( limit <= base )
+        return true;
+
+    printk(SLEXEC_DETA"discarding RAM outside of PMRs: 0x%Lx - 0x%Lx\n",
+           base, limit);
+    return e820_alloc_exclude(base, limit - base) &&
+           e820_reserve_ram(base, limit - base);
+}
+
+/*
+ * compute the VT-d PMR windows: the low one spans RAM below 4GB and the high
+ * one RAM above it, each shrunk just enough to keep the DMAR's RMRRs (which
+ * devices such as legacy USB controllers DMA to from SMM) unprotected
+ * must run before the e820 map is handed to the kernel, which has to see
+ * the RAM left outside the PMRs as reserved
+ * the returned ranges are 2M aligned and sized
+ */
 bool get_ram_ranges(uint64_t *min_lo_ram, uint64_t *max_lo_ram,
                     uint64_t *min_hi_ram, uint64_t *max_hi_ram)
 {
-    uint32_t min_ram = get_slexec_min_ram();
-    bool found_reserved_region = false;
-    uint64_t last_min_ram_base = 0, last_min_ram_size = 0;
+    static uint64_t rmrr_base[MAX_RMRRS], rmrr_limit[MAX_RMRRS];
+    memory_map_t *map = g_copy_e820_map;
+    unsigned int nr_map = g_nr_map;
+    uint64_t lo_ram = ~0ULL, hi_ram = ~0ULL, lo_end = 0, hi_end = 0;
+    uint64_t lo_max, hi_max, keep_limit;
+    unsigned int nr_rmrrs;
 
     if ( min_lo_ram == NULL || max_lo_ram == NULL ||
          min_hi_ram == NULL || max_hi_ram == NULL )
         return false;
 
-    *min_lo_ram = *min_hi_ram = ~0ULL;
-    *max_lo_ram = *max_hi_ram = 0;
-
-    /* TODO yes this nightmare was brought back from the dead. The real
-     * way to do this is by reading the RMRR structures in the DMAR.
-     */
     /*
-     * if min_ram > 0, we will never mark a region > min_ram in size
-     * as reserved even if it is after a reserved region (effectively
-     * we ignore reserved regions below the last type 1 region
-     * > min_ram in size)
-     * so in order to reserve RAM regions above this last region, we need
-     * to find it first so that we can tell when we have passed it
+     * on EFI use the firmware's own map, where boot services memory (which
+     * the kernel will get back) is told apart from runtime and ACPI data
      */
-    if ( min_ram > 0 ) {
-        get_highest_sized_ram(min_ram, 0x100000000ULL, &last_min_ram_base,
-                              &last_min_ram_size);
-        printk(SLEXEC_DETA"highest min_ram (0x%x) region found: base=0x%Lx, size=0x%Lx\n",
-               min_ram, last_min_ram_base, last_min_ram_size);
+    if ( g_nr_efi_map > 0 ) {
+        map = g_efi_map;
+        nr_map = g_nr_efi_map;
     }
 
-    for ( unsigned int i = 0; i < g_nr_map; i++ ) {
-        memory_map_t *entry = &g_copy_e820_map[i];
+    for ( unsigned int i = 0; i < nr_map; i++ ) {
+        memory_map_t *entry = &map[i];
         uint64_t base = e820_base_64(entry);
         uint64_t limit = base + e820_length_64(entry);
 
-        if ( entry->type == E820_RAM ) {
-            /* if range straddles 4GB boundary, that is an error */
-            if ( base < 0x100000000ULL && limit > 0x100000000ULL ) {
-                printk(SLEXEC_ERR"e820 memory range straddles 4GB boundary\n");
-                return false;
-            }
+        if ( !is_ram_type(entry->type) )
+            continue;
 
-            /*
-             * some BIOSes put legacy USB buffers in reserved regions <4GB,
-             * which if DMA protected cause SMM to hang, so make sure that
-             * we don't overlap any of these even if that wastes RAM
-             * ...unless min_ram was specified
-             */
-            if ( !found_reserved_region || base <= last_min_ram_base ) {
-                if ( base < 0x100000000ULL && base < *min_lo_ram )
-                    *min_lo_ram = base;
-                if ( limit <= 0x100000000ULL && limit > *max_lo_ram )
-                    *max_lo_ram = limit;
-            }
-            else {     /* need to reserve low RAM above reserved regions */
-                if ( base < 0x100000000ULL ) {
-                    printk(SLEXEC_DETA"discarding RAM above reserved regions: 0x%Lx - 0x%Lx\n", base, limit);
-                    if ( !e820_reserve_ram(base, limit - base) )
-                        return false;
-                }
-            }
+        /* if range straddles 4GB boundary, that is an error */
+        if ( base < 0x100000000ULL && limit > 0x100000000ULL ) {
+            printk(SLEXEC_ERR"e820 memory range straddles 4GB boundary\n");
+            return false;
+        }
 
-            if ( base >= 0x100000000ULL && base < *min_hi_ram )
-                *min_hi_ram = base;
-            if ( limit > 0x100000000ULL && limit > *max_hi_ram )
-                *max_hi_ram = limit;
+        if ( limit <= 0x100000000ULL ) {
+            if ( base < lo_ram )
+                lo_ram = base;
+            if ( limit > lo_end )
+                lo_end = limit;
         }
         else {
-            /* parts of low memory may be reserved for cseg, ISA hole,
-               etc. but these seem OK to DMA protect, so ignore reserved
-               regions <0x100000 */
-            if ( *min_lo_ram != ~0ULL && limit > 0x100000ULL )
-                found_reserved_region = true;
+            if ( base < hi_ram )
+                hi_ram = base;
+            if ( limit > hi_end )
+                hi_end = limit;
         }
     }
 
     /* no low RAM found */
-    if ( *min_lo_ram >= *max_lo_ram ) {
+    if ( lo_ram >= lo_end ) {
         printk(SLEXEC_ERR"no low ram in e820 map\n");
         return false;
     }
     /* no high RAM found */
-    if ( *min_hi_ram >= *max_hi_ram )
-        *min_hi_ram = *max_hi_ram = 0;
+    if ( hi_ram >= hi_end )
+        hi_ram = hi_end = 0;
+
+    /* same rounding set_vtd_pmrs() applies, so RMRR checks see final PMRs */
+    *min_lo_ram = lo_ram & ~(PMR_ALIGN - 1);
+    *max_lo_ram = *min_lo_ram + ((lo_end - *min_lo_ram) & ~(PMR_ALIGN - 1));
+    *min_hi_ram = hi_ram & ~(PMR_ALIGN - 1);
+    *max_hi_ram = *min_hi_ram + ((hi_end - *min_hi_ram) & ~(PMR_ALIGN - 1));
+
+    nr_rmrrs = get_dmar_rmrrs(rmrr_base, rmrr_limit, MAX_RMRRS);
+    if ( nr_rmrrs > MAX_RMRRS ) {
+        printk(SLEXEC_ERR"too many DMAR RMRRs (%u)\n", nr_rmrrs);
+        return false;
+    }
+
+    lo_max = *max_lo_ram;
+    hi_max = *max_hi_ram;
+    /*
+     * the low PMR has to keep covering slexec's low memory blocks (the SLR
+     * table, the AP wake block and the fallback MLE page tables), slexec
+     * itself and the MBI, right above which the MLE and its page tables
+     * are placed
+     */
+    keep_limit = get_slexec_mem_end();
+    if ( get_loader_ctx_end(g_ldr_ctx) > keep_limit )
+        keep_limit = get_loader_ctx_end(g_ldr_ctx);
+    if ( !exclude_rmrrs(map, nr_map, rmrr_base, rmrr_limit, nr_rmrrs,
+                        SLEXEC_SERIAL_LOG_ADDR, keep_limit,
+                        min_lo_ram, max_lo_ram) ||
+         !exclude_rmrrs(map, nr_map, rmrr_base, rmrr_limit, nr_rmrrs,
+                        ~0ULL, 0, min_hi_ram, max_hi_ram) )
+        return false;
+
+    if ( *min_lo_ram >= *max_lo_ram ) {
+        printk(SLEXEC_ERR"RMRRs leave no low ram to protect\n");
+        return false;
+    }
+
+    /* RAM that an RMRR pushed out of the PMRs */
+    if ( !reserve_unprotected_ram(lo_ram, *min_lo_ram) ||
+         !reserve_unprotected_ram(*max_lo_ram, lo_max) )
+        return false;
+    if ( hi_end != 0 &&
+         (!reserve_unprotected_ram(hi_ram, *min_hi_ram) ||
+          !reserve_unprotected_ram(*max_hi_ram, hi_max)) )
+        return false;
 
     return true;
 }
@@ -549,6 +820,164 @@ void get_highest_sized_ram(uint64_t size, uint64_t limit,
 }
 
 
+/*
+ * page allocator
+ *
+ * Allocations are carved out of a private copy of the memory map (the EFI
+ * one if we have it) in which everything that is not free for us to use
+ * (low memory, slexec, the MBI and the modules) has been reserved up front;
+ * every allocation is then reserved there and marked in the e820 copy with
+ * the type the caller asks for.
+ */
+static memory_map_t g_alloc_map[MAX_E820_ENTRIES];
+static unsigned int g_nr_alloc_map;
+
+bool e820_alloc_exclude(uint64_t addr, uint64_t size)
+{
+    return protect_region(g_alloc_map, &g_nr_alloc_map, addr, size,
+                          E820_RESERVED);
+}
+
+/* is all of [base, end) in <map> of a RAM type */
+static bool map_range_is_ram(memory_map_t *map, unsigned int nr_map,
+                             uint64_t base, uint64_t end)
+{
+    unsigned int i = first_ending_above(map, nr_map, base);
+
+    while ( base < end ) {
+        if ( i == nr_map || e820_base_64(&map[i]) > base ||
+             !is_ram_type(map[i].type) )
+            return false;
+        base = e820_end_64(&map[i++]);
+    }
+
+    return true;
+}
+
+/*
+ * e820_alloc_init
+ *
+ * Sets up the allocator from the e820 copy; must be called while the
+ * loader context still lists all of the modules
+ *
+ * return:  false = error (allocator map too big)
+ */
+bool e820_alloc_init(loader_ctx *lctx)
+{
+    unsigned int i;
+
+    if ( g_nr_efi_map > 0 ) {
+        /*
+         * the EFI map is the more precise view: start from its conventional
+         * memory and stay out of anything the e820 copy, which also holds
+         * our own reservations, does not list as RAM
+         */
+        sl_memcpy(g_alloc_map, g_efi_map,
+                  g_nr_efi_map * sizeof(memory_map_t));
+        g_nr_alloc_map = g_nr_efi_map;
+
+        for ( i = 0; i < g_nr_map; i++ ) {
+            memory_map_t *entry = &g_copy_e820_map[i];
+
+            if ( entry->type == E820_RAM )
+                continue;
+            if ( !e820_alloc_exclude(e820_base_64(entry),
+                                     e820_length_64(entry)) )
+                return false;
+        }
+
+        /* the MLE page tables and logs live at fixed low addresses */
+        if ( !map_range_is_ram(g_efi_map, g_nr_efi_map, SLEXEC_SERIAL_LOG_ADDR,
+                               SLEXEC_TIMELINE_ADDR + SLEXEC_TIMELINE_SIZE) )
+            printk(SLEXEC_WARN"slexec low memory overlaps EFI firmware memory\n");
+    }
+    else {
+        sl_memcpy(g_alloc_map, g_copy_e820_map,
+                  g_nr_map * sizeof(memory_map_t));
+        g_nr_alloc_map = g_nr_map;
+    }
+
+    /* legacy and slexec low memory regions */
+    if ( !e820_alloc_exclude(0, 0x100000) )
+        return false;
+
+    /* slexec itself */
+    if ( !e820_alloc_exclude(SLEXEC_BASE_ADDR,
+                             get_slexec_mem_end() - SLEXEC_BASE_ADDR) )
+        return false;
+
+    /* the MBI and the modules it describes */
+    if ( !e820_alloc_exclude(PAGE_DOWN(lctx->addr),
+                             get_loader_ctx_end(lctx) - PAGE_DOWN(lctx->addr)) )
+        return false;
+    for ( i = 0; i < get_module_count(lctx); i++ ) {
+        module_t *m = get_module(lctx, i);
+
+        if ( !e820_alloc_exclude(PAGE_DOWN(m->mod_start),
+                                 PAGE_UP(m->mod_end) -
+                                 PAGE_DOWN(m->mod_start)) )
+            return false;
+    }
+
+    printk(SLEXEC_DETA"e820 allocator map:\n");
+    print_map(g_alloc_map, g_nr_alloc_map);
+
+    return true;
+}
+
+/*
+ * e820_alloc
+ *
+ * Finds <size> bytes of free RAM aligned to <align> (a power of 2, at least
+ * a page) and ending at or below <limit>, searching from the top or bottom
+ * of memory as per <flags>, and marks it as <type> in the e820 copy
+ *
+ * return:  base of the allocation, 0 = no fit
+ */
+uint64_t e820_alloc(uint64_t size, uint64_t align, uint64_t limit,
+                    uint32_t flags, uint32_t type)
+{
+    bool top_down = flags & E820_ALLOC_TOP_DOWN;
+
+    if ( align < PAGE_SIZE )
+        align = PAGE_SIZE;
+    if ( size == 0 || (align & (align - 1)) != 0 )
+        return 0;
+    size = (size + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1);
+
+    for ( unsigned int n = 0; n < g_nr_alloc_map; n++ ) {
+        unsigned int i = top_down ? g_nr_alloc_map - 1 - n : n;
+        memory_map_t *entry = &g_alloc_map[i];
+        uint64_t base = e820_base_64(entry);
+        uint64_t end = e820_end_64(entry);
+        uint64_t addr;
+
+        if ( entry->type != E820_RAM )
+            continue;
+        if ( end > limit )
+            end = limit;
+        if ( end <= base || end - base < size )
+            continue;
+
+        if ( top_down )
+            addr = (end - size) & ~(align - 1);
+        else
+            addr = (base + align - 1) & ~(align - 1);
+        if ( addr < base || addr + size > end )
+            continue;
+
+        if ( !e820_alloc_exclude(addr, size) ||
+             !protect_region(g_copy_e820_map, &g_nr_map, addr, size, type) )
+            return 0;
+
+        printk(SLEXEC_DETA"e820 allocated 0x%Lx - 0x%Lx\n",
+               (unsigned long long)addr, (unsigned long long)(addr + size));
+        return addr;
+    }
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_LOADER
+
 #include <types.h>
 #include <slexec.h>
 #include <stdbool.h>
@@ -44,6 +46,7 @@
 #include <cmdline.h>
 #include <misc.h>
 #include <processor.h>
+#include <lz4.h>
 #include <skinit/skl.h>
 
 extern loader_ctx *g_ldr_ctx;
@@ -52,6 +55,9 @@ static boot_params_t *boot_params;
 
 sl_kernel_setup_t g_sl_kernel_setup = {0};
 
+/* concatenated cpio archives each have to start 4 byte aligned */
+#define INITRD_ALIGN(x)    (((x) + 3) & ~3ULL)
+
 static void
 printk_long(const char *what)
 {
@@ -69,20 +75,203 @@ printk_long(const char *what)
     }
 }
 
-/* expand linux kernel with kernel image and initrd image */
+/*
+ * copy the adjusted e820 map into the zero page; entries beyond its E820MAX
+ * slots go in a SETUP_E820_EXT setup_data node chained off the header
+ */
+static bool linux_setup_e820(boot_params_t *boot_params)
+{
+    memory_map_t *map = get_e820_copy();
+    unsigned int nr_map = get_nr_map();
+    e820entry_t *entries = boot_params->e820_map;
+    setup_data_t *data = NULL;
+    uint64_t base;
+    uint32_t ext_len;
+
+    if ( nr_map > E820MAX ) {
+        /* the kernel reserves setup_data itself, so leave it RAM */
+        ext_len = (nr_map - E820MAX) * sizeof(e820entry_t);
+        base = e820_alloc(sizeof(setup_data_t) + ext_len, PAGE_SIZE,
+                          0x100000000ULL, E820_ALLOC_TOP_DOWN, E820_RAM);
+        if ( base == 0 ) {
+            printk(SLEXEC_ERR"no memory for extended e820 setup_data\n");
+            return false;
+        }
+        data = (setup_data_t *)(uint32_t)base;
+        data->type = SETUP_E820_EXT;
+        data->len = ext_len;
+    }
+
+    for ( unsigned int i = 0; i < nr_map; i++ ) {
+        if ( i == E820MAX )
+            entries = (e820entry_t *)((u8 *)data + sizeof(setup_data_t));
+        entries->addr = ((uint64_t)map[i].base_addr_high << 32)
+                        | (uint64_t)map[i].base_addr_low;
+        entries->size = ((uint64_t)map[i].length_high << 32)
+                        | (uint64_t)map[i].length_low;
+        entries->type = map[i].type;
+        entries++;
+    }
+    boot_params->e820_entries = (nr_map > E820MAX) ? E820MAX : nr_map;
+
+    if ( data != NULL ) {
+        data->next = boot_params->hdr.setup_data;
+        boot_params->hdr.setup_data = (uint64_t)(uint32_t)data;
+        printk(SLEXEC_INFO"e820 entries beyond %u in setup_data at %p\n",
+               E820MAX, data);
+    }
+
+    return true;
+}
+
+/*
+ * place the initrd pieces back to back, each padded to the 4 byte alignment
+ * the kernel's cpio unpacker expects between concatenated archives, and
+ * record the result in the kernel header
+ */
+static bool load_initrds(linux_kernel_header_t *hdr,
+                         const linux_initrd_t *initrds, unsigned int nr_initrds,
+                         uint32_t kernel_base, unsigned long kernel_size)
+{
+    size_t sizes[LINUX_MAX_INITRDS];
+    unsigned long src_end = 0;
+    uint64_t ramdisk_size = 0;
+    bool in_place = true;
+    uint64_t mem_limit;
+    uint32_t initrd_base;
+    unsigned int i;
+
+    hdr->ramdisk_image = 0;
+    hdr->ramdisk_size = 0;
+    if ( nr_initrds == 0 )
+        return true;
+    if ( nr_initrds > LINUX_MAX_INITRDS ) {
+        printk(SLEXEC_ERR"too many initrd modules (%u)\n", nr_initrds);
+        return false;
+    }
+
+    /* check if Linux command line explicitly specified a memory limit */
+    get_linux_mem(&mem_limit);
+    if ( mem_limit > 0x100000000ULL || mem_limit == 0 )
+        mem_limit = 0x100000000ULL;
+
+    /* should not exceed initrd_addr_max */
+    if ( mem_limit > (uint64_t)hdr->initrd_addr_max + 1 )
+        mem_limit = (uint64_t)hdr->initrd_addr_max + 1;
+
+    /* size everything up front so the modules are only read once below */
+    for ( i = 0; i < nr_initrds; i++ ) {
+        unsigned long src = (unsigned long)initrds[i].image;
+
+        sizes[i] = initrds[i].size;
+        if ( is_lz4_frame(initrds[i].image, initrds[i].size) ) {
+            /* an LZ4 compressed piece is expanded right into place */
+            sizes[i] = lz4_frame_decoded_size(initrds[i].image,
+                                              initrds[i].size);
+            if ( sizes[i] == 0 ) {
+                printk(SLEXEC_ERR"bad LZ4 compressed initrd module %u\n", i);
+                return false;
+            }
+            in_place = false;
+        }
+
+        /* already laid out the way we would copy them? */
+        if ( i > 0 && src != INITRD_ALIGN(src_end) )
+            in_place = false;
+        src_end = src + initrds[i].size;
+
+        /* summed in 64 bits, so only the limit can be exceeded */
+        if ( i > 0 )
+            ramdisk_size = INITRD_ALIGN(ramdisk_size);
+        ramdisk_size += sizes[i];
+        if ( ramdisk_size > mem_limit ) {
+            printk(SLEXEC_ERR"initrd (0x%Lx bytes so far) larger than the "
+                   "memory limit 0x%Lx\n", ramdisk_size, mem_limit);
+            return false;
+        }
+    }
+
+    if ( in_place ) {
+        /* the modules are kept out of allocations already, so just make
+           sure they are somewhere the kernel can use them from */
+        initrd_base = (uint32_t)initrds[0].image;
+        if ( (initrd_base & 3) || initrd_base < 0x100000 ||
+             (uint64_t)initrd_base + ramdisk_size > mem_limit ||
+             (initrd_base < kernel_base + kernel_size &&
+              initrd_base + ramdisk_size > kernel_base) )
+            in_place = false;
+    }
+
+    if ( in_place ) {
+        /* only the alignment slack between the modules needs clearing */
+        for ( i = 1; i < nr_initrds; i++ ) {
+            unsigned long prev_end = (unsigned long)initrds[i - 1].image +
+                                     initrds[i - 1].size;
+            sl_memset((void *)prev_end, 0,
+                      (unsigned long)initrds[i].image - prev_end);
+        }
+        printk(SLEXEC_INFO"Initrd modules already contiguous, using in place\n");
+    }
+    else {
+        unsigned long dest;
+
+        /* The initrd should typically be located as high in memory as
+           possible, as it may otherwise get overwritten by the early
+           kernel initialization sequence. The kernel frees the initrd
+           once done with it, so it stays RAM. */
+        initrd_base = (uint32_t)e820_alloc(ramdisk_size, PAGE_SIZE, mem_limit,
+                                           E820_ALLOC_TOP_DOWN, E820_RAM);
+        if ( initrd_base == 0 ) {
+            printk(SLEXEC_ERR"not enough RAM for initrd\n");
+            return false;
+        }
+
+        /* the allocator never hands out module memory, so no overlaps */
+        dest = initrd_base;
+        for ( i = 0; i < nr_initrds; i++ ) {
+            if ( i > 0 ) {
+                sl_memset((void *)dest, 0, INITRD_ALIGN(dest) - dest);
+                dest = INITRD_ALIGN(dest);
+            }
+            if ( is_lz4_frame(initrds[i].image, initrds[i].size) ) {
+                if ( lz4_frame_decompress(initrds[i].image, initrds[i].size,
+                                          (void *)dest, sizes[i])
+                     != sizes[i] ) {
+                    printk(SLEXEC_ERR"failed to decompress initrd module %u\n",
+                           i);
+                    return false;
+                }
+            }
+            else
+                sl_memmove((void *)dest, initrds[i].image, sizes[i]);
+            dest += sizes[i];
+        }
+    }
+
+    printk(SLEXEC_ERR"Initrd (%u module%s) from 0x%lx to 0x%lx\n",
+           nr_initrds, nr_initrds > 1 ? "s" : "",
+           (unsigned long)initrd_base,
+           (unsigned long)(initrd_base + ramdisk_size));
+
+    hdr->ramdisk_image = initrd_base;
+    hdr->ramdisk_size = ramdisk_size;
+    return true;
+}
+
+/* expand linux kernel with kernel image and initrd images */
 bool expand_linux_image(const void *linux_image, size_t linux_size,
-                        const void *initrd_image, size_t initrd_size)
+                        const linux_initrd_t *initrds, unsigned int nr_initrds)
 {
     linux_kernel_header_t *hdr;
     linux_kernel_header_t temp_hdr;
     uint32_t real_mode_base, protected_mode_base;
     unsigned long real_mode_size, protected_mode_size;
         /* Note: real_mode_size + protected_mode_size = linux_size */
-    uint32_t initrd_base;
+    unsigned long kernel_mem_size;
     int vid_mode = 0;
 
-    printk(SLEXEC_ERR"Expand - Linux kernel image: %p initrd image: %p\n",
-           linux_image, initrd_image);
+    printk(SLEXEC_ERR"Expand - Linux kernel image: %p initrd modules: %u\n",
+           linux_image, nr_initrds);
 
     /* Check param */
     if ( linux_image == NULL ) {
@@ -157,93 +346,13 @@ bool expand_linux_image(const void *linux_image, size_t linux_size,
     hdr->loadflags |= FLAG_CAN_USE_HEAP;         /* can use heap */
     hdr->heap_end_ptr = KERNEL_CMDLINE_OFFSET - BOOT_SECTOR_OFFSET;
 
-    if ( initrd_size > 0 ) {
-        /* load initrd and set ramdisk_image and ramdisk_size */
-        /* The initrd should typically be located as high in memory as
-           possible, as it may otherwise get overwritten by the early
-           kernel initialization sequence. */
-
-        /* check if Linux command line explicitly specified a memory limit */
-        uint64_t mem_limit;
-        get_linux_mem(&mem_limit);
-        if ( mem_limit > 0x100000000ULL || mem_limit == 0 )
-            mem_limit = 0x100000000ULL;
-
-        uint64_t max_ram_base, max_ram_size;
-        get_highest_sized_ram(initrd_size, mem_limit,
-                              &max_ram_base, &max_ram_size);
-        if ( max_ram_size == 0 ) {
-            printk(SLEXEC_ERR"not enough RAM for initrd\n");
-            return false;
-        }
-        if ( initrd_size > max_ram_size ) {
-            printk(SLEXEC_ERR"initrd_size is too large\n");
-            return false;
-        }
-        if ( max_ram_base > ((uint64_t)(uint32_t)(~0)) ) {
-            printk(SLEXEC_ERR"max_ram_base is too high\n");
-            return false;
-        }
-        if ( plus_overflow_u32((uint32_t)max_ram_base,
-                 (uint32_t)(max_ram_size - initrd_size)) ) {
-            printk(SLEXEC_ERR"max_ram overflows\n");
-            return false;
-        }
-        /*initrd_base = (max_ram_base + max_ram_size - initrd_size) & PAGE_MASK;*/
-
-        /*
-         * TODO used fixed allocation:
-         * The location, initrd_base, determined above in the commented out
-         * code causes memory corruption. This value leads to the corruption
-         * of EFI System Resource Table (ESRT), which is also located in RAM.
-         *
-         * NEED better memory allocator to avoid fixed addesses like this.
-         */
-        initrd_base = SLEXEC_FIXED_INITRD_BASE;
-
-        /* should not exceed initrd_addr_max */
-        if ( initrd_base + initrd_size > hdr->initrd_addr_max ) {
-            if ( hdr->initrd_addr_max < initrd_size ) {
-                printk(SLEXEC_ERR"initrd_addr_max is too small\n");
-                return false;
-            }
-            initrd_base = hdr->initrd_addr_max - initrd_size;
-            initrd_base = initrd_base & PAGE_MASK;
-        }
-
-        /* check for overlap with a kernel image placed high in memory */
-        if( (initrd_base < ((uint32_t)linux_image + linux_size))
-            && ((uint32_t)linux_image < (initrd_base+initrd_size)) ){
-            /* set the starting address just below the image */
-            initrd_base = (uint32_t)linux_image - initrd_size;
-            initrd_base = initrd_base & PAGE_MASK;
-            /* make sure we're still in usable RAM and above slexec end address*/
-            if( initrd_base < max_ram_base ){
-                printk(SLEXEC_ERR"no available memory for initrd\n");
-                return false;
-            }
-        }
-
-        sl_memmove((void *)initrd_base, initrd_image, initrd_size);
-        printk(SLEXEC_ERR"Initrd from 0x%lx to 0x%lx\n",
-               (unsigned long)initrd_base,
-               (unsigned long)(initrd_base + initrd_size));
-
-        hdr->ramdisk_image = initrd_base;
-        hdr->ramdisk_size = initrd_size;
-    }
-    else {
-        hdr->ramdisk_image = 0;
-        hdr->ramdisk_size = 0;
-    }
-
     /* calc location of real mode part */
     real_mode_base = LEGACY_REAL_START;
     if ( have_loader_memlimits(g_ldr_ctx))
         real_mode_base =
             ((get_loader_mem_lower(g_ldr_ctx)) << 10) - REAL_MODE_SIZE;
-    if ( real_mode_base < SLEXEC_MLEPT_ADDR + SLEXEC_MLEPT_SIZE )
-        real_mode_base = SLEXEC_MLEPT_ADDR + SLEXEC_MLEPT_SIZE;
+    if ( real_mode_base < SLEXEC_TIMELINE_ADDR + SLEXEC_TIMELINE_SIZE )
+        real_mode_base = SLEXEC_TIMELINE_ADDR + SLEXEC_TIMELINE_SIZE;
     if ( real_mode_base > LEGACY_REAL_START )
         real_mode_base = LEGACY_REAL_START;
 
@@ -310,6 +419,23 @@ bool expand_linux_image(const void *linux_image, size_t linux_size,
         return false;
     }
 
+    /* the kernel decompresses in place, keep allocations out of its way */
+    kernel_mem_size = protected_mode_size;
+    if ( hdr->version >= 0x020a && hdr->init_size > kernel_mem_size )
+        kernel_mem_size = hdr->init_size;
+    if ( !e820_alloc_exclude(protected_mode_base, kernel_mem_size) ) {
+        printk(SLEXEC_ERR"failed to exclude kernel from allocations\n");
+        return false;
+    }
+
+    if ( !load_initrds(hdr, initrds, nr_initrds,
+                       protected_mode_base, kernel_mem_size) )
+        return false;
+
+    /* the kernel may land on the bootloader's MBI, so emit ours first */
+    if ( !rewrite_loader_ctx(g_ldr_ctx) )
+        return false;
+
     /* save linux header struct to temp memory to copy changes to zero page */
     sl_memmove(&temp_hdr, hdr, sizeof(temp_hdr));
 
@@ -413,28 +539,9 @@ bool expand_linux_image(const void *linux_image, size_t linux_size,
         load_framebuffer_info(g_ldr_ctx, (void *)scr);
     }
 
-    /* detect e820 table */
-    if (have_loader_memmap(g_ldr_ctx)) {
-        int i;
-
-        memory_map_t *p = get_loader_memmap(g_ldr_ctx);
-        if ( p == NULL ) {
-            printk(SLEXEC_ERR"Error: no memory map available\n");
-            return false;
-        }
-        uint32_t memmap_start = (uint32_t) p;
-        uint32_t memmap_length = get_loader_memmap_length(g_ldr_ctx);
-        for ( i = 0; (uint32_t)p < memmap_start + memmap_length; i++ )
-        {
-            boot_params->e820_map[i].addr = ((uint64_t)p->base_addr_high << 32)
-                                            | (uint64_t)p->base_addr_low;
-            boot_params->e820_map[i].size = ((uint64_t)p->length_high << 32)
-                                            | (uint64_t)p->length_low;
-            boot_params->e820_map[i].type = p->type;
-            p = (void *)p + sizeof(memory_map_t);
-        }
-        boot_params->e820_entries = i;
-    }
+    /* hand over our adjusted e820 table */
+    if ( !linux_setup_e820(boot_params) )
+        return false;
 
     if (0 == is_loader_launch_efi(g_ldr_ctx)){
         screen_info_t *screen = (screen_info_t *)&boot_params->screen_info;
@@ -35,6 +35,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_LOADER
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -52,14 +54,8 @@
 #include <txt/acmod.h>
 #include <skinit/skl.h>
 
-/* TODO the MB2 handling has some issues, especially when things are moved or
- * made bigger in the MB2 data area. See cc66e042d1e3f8e675ea520202a20681e5f00553
- * e.g.
- */
-
 /* multiboot struct saved so that post_launch() can use it (in slexec.c) */
 extern loader_ctx *g_ldr_ctx;
-static uint32_t g_mb_orig_size;
 
 #define LOADER_CTX_BAD(xctx) \
     xctx == NULL ? true : \
@@ -128,29 +124,74 @@ static struct mb2_tag
     return start;
 }
 
-static module_t
-*get_module_mb2(loader_ctx *lctx, unsigned int i)
+/*
+ * index of the MB2 tags: built by determine_loader_type() and again each
+ * time the MBI is rewritten, so that lookups don't have to walk the tag list
+ */
+#define MB2_TAG_TYPE_COUNT    (MB2_TAG_TYPE_EFI_BS + 1)
+#define MB2_MAX_MODULES       64
+
+static struct {
+    struct mb2_tag *first[MB2_TAG_TYPE_COUNT];    /* first tag of a type */
+    struct mb2_tag_module *mods[MB2_MAX_MODULES];
+    unsigned int nr_mods;
+} g_mb2_index;
+
+/*
+ * edits to the MB2 info; the tags aren't touched until rewrite_loader_ctx()
+ * emits a new MBI with all of them applied in a single pass
+ */
+#define MB2_MAX_REMOVED       (MB2_MAX_MODULES + 1)  /* + ELF sections */
+
+static struct {
+    struct mb2_tag *removed[MB2_MAX_REMOVED];
+    unsigned int nr_removed;
+    const char *cmdline;        /* replacement command line */
+    bool e820_copy;             /* replace memory map with the e820 copy */
+} g_mb2_edits;
+
+static bool mb2_tag_removed(struct mb2_tag *tag)
 {
-    struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-    unsigned int ii;
-    struct mb2_tag_module *tag_mod = NULL;
-    module_t *mt = NULL;
-    start = find_mb2_tag_type(start, MB2_TAG_TYPE_MODULE);
-    if (start != NULL){
-        for (ii = 1; ii <= i; ii++){
-            if (start == NULL)
-                return NULL;
-            else {
-                /* nudge off this hit */
-                start = next_mb2_tag(start);
-                start = find_mb2_tag_type(start, MB2_TAG_TYPE_MODULE);
+    for ( unsigned int i = 0; i < g_mb2_edits.nr_removed; i++ )
+        if ( g_mb2_edits.removed[i] == tag )
+            return true;
+    return false;
+}
+
+static bool mb2_index_build(loader_ctx *lctx)
+{
+    struct mb2_tag *tag = (struct mb2_tag *)(lctx->addr + 8);
+
+    sl_memset(&g_mb2_index, 0, sizeof(g_mb2_index));
+    for ( ; tag != NULL; tag = next_mb2_tag(tag) ) {
+        if ( tag->type == MB2_TAG_TYPE_MODULE ) {
+            if ( g_mb2_index.nr_mods == MB2_MAX_MODULES ) {
+                printk(SLEXEC_ERR"too many MB2 modules (max %d)\n",
+                       MB2_MAX_MODULES);
+                return false;
             }
+            g_mb2_index.mods[g_mb2_index.nr_mods++] =
+                (struct mb2_tag_module *)tag;
         }
-        /* if we're here, we have the tag struct for the desired module */
-        tag_mod = (struct mb2_tag_module *) start;
-        mt = (module_t *) &(tag_mod->mod_start);
+        if ( tag->type < MB2_TAG_TYPE_COUNT &&
+             g_mb2_index.first[tag->type] == NULL )
+            g_mb2_index.first[tag->type] = tag;
     }
-    return mt;
+
+    return true;
+}
+
+static struct mb2_tag *get_mb2_tag(uint32_t type)
+{
+    return g_mb2_index.first[type];
+}
+
+static module_t
+*get_module_mb2(unsigned int i)
+{
+    if ( i >= g_mb2_index.nr_mods )
+        return NULL;
+    return (module_t *) &(g_mb2_index.mods[i]->mod_start);
 }
 
 bool verify_loader_context(loader_ctx *lctx)
@@ -166,81 +207,144 @@ bool verify_loader_context(loader_ctx *lctx)
         return true;
 }
 
-static bool remove_mb2_tag(loader_ctx *lctx, struct mb2_tag *cur)
+static bool remove_mb2_tag(struct mb2_tag *cur)
 {
-    uint8_t *s, *d, *e;
-    struct mb2_tag *next, *end;
-    next = next_mb2_tag(cur);
-    if (next == NULL){
-        printk(SLEXEC_ERR"missing next tag in remove_mb2_tag\n");
+    if ( g_mb2_edits.nr_removed == MB2_MAX_REMOVED ) {
+        printk(SLEXEC_ERR"too many MB2 tags removed\n");
         return false;
     }
-    /* where do we stop? */
-    end = (struct mb2_tag *)(lctx->addr + 8);
-    end = find_mb2_tag_type(end, MB2_TAG_TYPE_END);
-    if (end == NULL){
-        printk(SLEXEC_ERR"remove_mb2_tag, no end tag!!!!\n");
-        return false;
+    g_mb2_edits.removed[g_mb2_edits.nr_removed++] = cur;
+
+    /* take it out of the index */
+    if ( cur->type == MB2_TAG_TYPE_MODULE ) {
+        for ( unsigned int i = 0; i < g_mb2_index.nr_mods; i++ ) {
+            if ( (struct mb2_tag *)g_mb2_index.mods[i] != cur )
+                continue;
+            sl_memmove(&g_mb2_index.mods[i], &g_mb2_index.mods[i + 1],
+                       (g_mb2_index.nr_mods - i - 1) *
+                       sizeof(g_mb2_index.mods[0]));
+            g_mb2_index.nr_mods--;
+            break;
+        }
     }
-    e = (uint8_t *) end + end->size;
-    /* we'll do this byte-wise */
-    s = (uint8_t *) next; d = (uint8_t *) cur;
-
-    while (s <= e) {
-        *d = *s; d++; s++;
+    if ( cur->type < MB2_TAG_TYPE_COUNT &&
+         g_mb2_index.first[cur->type] == cur ) {
+        struct mb2_tag *next = cur;
+
+        do
+            next = find_mb2_tag_type(next_mb2_tag(next), cur->type);
+        while ( next != NULL && mb2_tag_removed(next) );
+        g_mb2_index.first[cur->type] = next;
     }
-    /* adjust MB2 length */
-    *((unsigned long *) lctx->addr) -=
-        (uint8_t *)next - (uint8_t *)cur;
-    /* sanity check */
-    /* print_loader_ctx(lctx); */
+
     return true;
 }
 
-static bool
-grow_mb2_tag(loader_ctx *lctx, struct mb2_tag *which, uint32_t how_much)
+/* size of <tag> in the rewritten MBI (padding excluded) */
+static uint32_t mb2_edited_tag_size(struct mb2_tag *tag)
 {
-    struct mb2_tag *next, *new_next, *end;
-    int growth, slack;
-    uint8_t *s, *d;
-    // uint32_t old_size = which->size;
-
-    /* we're holding the tag struct to grow, get its successor */
-    next = next_mb2_tag(which);
-
-    /* find the end--we will need it */
-    end = (struct mb2_tag *)(lctx->addr + 8);
-    end = find_mb2_tag_type(end, MB2_TAG_TYPE_END);
-    if ( end == NULL )
-        return false;
+    if ( tag->type == MB2_TAG_TYPE_CMDLINE && g_mb2_edits.cmdline != NULL )
+        return sizeof(struct mb2_tag_string) +
+               sl_strlen(g_mb2_edits.cmdline) + 1;
+    /* the MB1-style entries are shifted 4 bytes to line up (see below) */
+    if ( tag->type == MB2_TAG_TYPE_MMAP && g_mb2_edits.e820_copy )
+        return sizeof(struct mb2_tag_mmap) +
+               get_nr_map() * sizeof(memory_map_t);
+    return tag->size;
+}
 
-    /* How much bigger does it need to be? */
-    /* NOTE: this breaks the MBI 2 structure for walking
-     * until we're done copying.
-     */
-    which->size += how_much;
+/* write <tag>, with any edits applied, to <dest> */
+static void mb2_emit_tag(struct mb2_tag *tag, uint8_t *dest, uint32_t size)
+{
+    if ( tag->type == MB2_TAG_TYPE_CMDLINE && g_mb2_edits.cmdline != NULL ) {
+        struct mb2_tag_string *cmd = (struct mb2_tag_string *)dest;
 
-    /* what's the new growth for its successor? */
-    new_next = next_mb2_tag(which);
-    growth = ((void *) new_next) - ((void *) next);
+        cmd->type = tag->type;
+        cmd->size = size;
+        sl_strcpy(cmd->string, g_mb2_edits.cmdline);
+    }
+    else if ( tag->type == MB2_TAG_TYPE_MMAP && g_mb2_edits.e820_copy ) {
+        struct mb2_tag_mmap *mmap = (struct mb2_tag_mmap *)dest;
 
-    /* check to make sure there's actually room for the growth */
-    slack = g_mb_orig_size - *(uint32_t *) (lctx->addr);
-    if (growth > slack){
-        printk(SLEXEC_ERR"YIKES!!! grow_mb2_tag slack %d < growth %d\n",
-               slack, growth);
+        mmap->type = tag->type;
+        mmap->size = size;
+        mmap->entry_size = sizeof(struct mb2_mmap_entry);
+        /*
+         * RLM: for now, we'll leave the entries in MB1 format (with real
+         * size); starting them at entry_version lines the two tables up,
+         * with each size landing on the previous entry's zero field
+         */
+        sl_memcpy(&mmap->entry_version, get_e820_copy(),
+                  get_nr_map() * sizeof(memory_map_t));
+        *(uint32_t *)(dest + size - sizeof(uint32_t)) = 0;
     }
+    else
+        sl_memcpy(dest, tag, size);
+}
 
-    /* now we copy down from the bottom, going up */
-    s = ((uint8_t *) end) + end->size;
-    d = s + growth;
-    while (s >= (uint8_t *)next){
-        *d = *s;
-        d--; s--;
+/*
+ * emit the MBI at <lctx> with all pending edits applied to <dest> in one
+ * pass over the tags; with <dest> NULL only the size is computed
+ */
+static uint32_t mb2_rewrite(loader_ctx *lctx, uint8_t *dest)
+{
+    struct mb2_tag *tag = (struct mb2_tag *)(lctx->addr + 8);
+    uint32_t total = 8;
+
+    for ( ; tag != NULL; tag = next_mb2_tag(tag) ) {
+        uint32_t size, padded;
+
+        if ( mb2_tag_removed(tag) )
+            continue;
+        size = mb2_edited_tag_size(tag);
+        padded = (size + 7) & ~7;
+        if ( dest != NULL ) {
+            mb2_emit_tag(tag, dest + total, size);
+            sl_memset(dest + total + size, 0, padded - size);
+        }
+        total += padded;
     }
-    /* adjust MB2 length */
-    *((uint32_t *) lctx->addr) += growth;
-    return true;
+
+    if ( dest != NULL ) {
+        ((uint32_t *)dest)[0] = total;
+        ((uint32_t *)dest)[1] = ((uint32_t *)lctx->addr)[1];
+    }
+    return total;
+}
+
+/*
+ * rewrite_loader_ctx
+ *
+ * Materializes the MBI with all edits made so far (removed modules, new
+ * command line and memory map) in a freshly allocated buffer and points the
+ * loader context at it; MB1 edits are made in place so there is nothing to do
+ *
+ * return:  false = error (no memory for the new MBI)
+ */
+bool rewrite_loader_ctx(loader_ctx *lctx)
+{
+    uint32_t size;
+    uint64_t base;
+
+    if (LOADER_CTX_BAD(lctx))
+        return false;
+    if (lctx->type != MB2_ONLY)
+        return true;
+
+    size = mb2_rewrite(lctx, NULL);
+    base = e820_alloc(size, PAGE_SIZE, 0x100000000ULL, E820_ALLOC_TOP_DOWN,
+                      E820_RAM);
+    if ( base == 0 ) {
+        printk(SLEXEC_ERR"no memory for rewritten MB2 info (0x%x)\n", size);
+        return false;
+    }
+
+    mb2_rewrite(lctx, (uint8_t *)(uint32_t)base);
+    lctx->addr = (void *)(uint32_t)base;
+    sl_memset(&g_mb2_edits, 0, sizeof(g_mb2_edits));
+    printk(SLEXEC_INFO"MB2 rewritten to: %p size: %x\n", lctx->addr, size);
+
+    return mb2_index_build(lctx);
 }
 
 static void *remove_module(loader_ctx *lctx, void *mod_start)
@@ -258,7 +362,7 @@ static void *remove_module(loader_ctx *lctx, void *mod_start)
     }
 
     /* not found */
-    if ( m == NULL ) {
+    if ( m == NULL || i == get_module_count(lctx) ) {
         printk(SLEXEC_ERR"could not find module to remove\n");
         return NULL;
     }
@@ -284,13 +388,10 @@ static void *remove_module(loader_ctx *lctx, void *mod_start)
     if (lctx->type == MB2_ONLY){
         /* multiboot 2 */
         /* if we're removing the first module (i.e. the "kernel") then */
-        /* need to adjust some mbi fields as well */
-        char cmdbuf[SLEXEC_KERNEL_CMDLINE_SIZE];
-        cmdbuf[0] = '\0';
+        /* its command line becomes the MBI's */
         if ( mod_start == NULL ) {
-            char *cmdline = get_cmdline(lctx);
             char *mod_string = get_module_cmd(lctx, m);
-            if ( cmdline == NULL ) {
+            if ( get_cmdline(lctx) == NULL ) {
                 printk(SLEXEC_ERR"could not find cmdline\n");
                 return NULL;
             }
@@ -298,99 +399,16 @@ static void *remove_module(loader_ctx *lctx, void *mod_start)
                 printk(SLEXEC_ERR"could not find module cmdline\n");
                 return NULL;
             }
-            if ((sl_strlen(mod_string)) > (sl_strlen(cmdline))){
-                if (sl_strlen(mod_string) >= SLEXEC_KERNEL_CMDLINE_SIZE){
-                    printk(SLEXEC_ERR"No room to copy MB2 cmdline [%d < %d]\n",
-                           (int)(sl_strlen(cmdline)), (int)(sl_strlen(mod_string)));
-                } else {
-                    char *s = mod_string;
-                    char *d = cmdbuf;
-                    while (*s){
-                        *d = *s;
-                        d++; s++;
-                    }
-                    *d = *s;
-                    // strcpy(cmdbuf, mod_string);
-                }
-            } else {
-                // strcpy(cmdline,mod_string);
-                char *s = mod_string;
-                char *d = cmdline;
-                while (*s){
-                    *d = *s;
-                    d++; s++;
-                }
-                *d = *s;
-                /* note: we didn't adjust the "size" field, since it didn't
-                 * grow and this saves us the pain of shuffling everything
-                 * after cmdline (which is usually first)
-                 */
-            }
+            g_mb2_edits.cmdline = mod_string;
             mod_start = (void *)m->mod_start;
         }
-        /* so MB2 is a different beast.  The modules aren't necessarily
-         * adjacent, first, last, anything.  What we can do is bulk copy
-         * everything after the thing we're killing over the top of it,
-         * and shorten the total length of the MB2 structure.
-         */
-        {
-            struct mb2_tag *cur;
-            struct mb2_tag_module *mod = NULL;
-            module_t *cur_mod = NULL;
-            cur = (struct mb2_tag *)(lctx->addr + 8);
-            cur = find_mb2_tag_type(cur, MB2_TAG_TYPE_MODULE);
-            mod = (struct mb2_tag_module *) cur;
-            if (mod != NULL)
-                cur_mod = (module_t *)&(mod->mod_start);
-
-            while (cur_mod != NULL && cur_mod != m){
-                /* nudge off current record */
-                cur = next_mb2_tag(cur);
-                cur = find_mb2_tag_type(cur, MB2_TAG_TYPE_MODULE);
-                mod = (struct mb2_tag_module *) cur;
-                if (mod != NULL)
-                    cur_mod = (module_t *)&(mod->mod_start);
-                else
-                    cur_mod = NULL;
-            }
-            if (cur_mod == NULL){
-                printk(SLEXEC_ERR"remove_module() for MB2 failed\n");
-                return NULL;
-            }
-
-            /* we're here.  cur is the MB2 tag we need to overwrite. */
-            if (false == remove_mb2_tag(lctx, cur))
-                return NULL;
-        }
-        if (cmdbuf[0] != '\0'){
-            /* we need to grow the mb2_tag_string that holds the cmdline.
-             * we know there's room, since we've shortened the MB2 by the
-             * length of the module_tag we've removed, which contained
-             * the longer string.
-             */
-            struct mb2_tag *cur = (struct mb2_tag *)(lctx->addr + 8);
-            struct mb2_tag_string *cmd;
-
-            cur = find_mb2_tag_type(cur, MB2_TAG_TYPE_CMDLINE);
-            cmd = (struct mb2_tag_string *) cur;
-            if (cmd == NULL){
-                printk(SLEXEC_ERR"remove_modules MB2 shuffle NULL cmd\n");
-                return NULL;
-            }
-
-            grow_mb2_tag(lctx, cur, sl_strlen(cmdbuf) - sl_strlen(cmd->string));
-
-            /* now we're all good, except for fixing up cmd */
-            {
-                char * s = cmdbuf;
-                char *d = cmd->string;
-                while (*s){
-                    *d = *s;
-                    d++; s++;
-                }
-                *d = *s;
-            }
+        /* the module tag (and its string) stays put until the rewrite */
+        if ( i >= g_mb2_index.nr_mods ) {
+            printk(SLEXEC_ERR"remove_module() for MB2 failed\n");
+            return NULL;
         }
+        if ( !remove_mb2_tag((struct mb2_tag *)g_mb2_index.mods[i]) )
+            return NULL;
         return mod_start;
     }
     return NULL;
@@ -453,7 +471,7 @@ module_t *get_module(loader_ctx *lctx, unsigned int i)
         return(get_module_mb1((multiboot_info_t *) lctx->addr, i));
     } else {
         /* so currently, must be type 2 */
-        return(get_module_mb2(lctx, i));
+        return(get_module_mb2(i));
     }
 }
 
@@ -500,8 +518,8 @@ bool prepare_intermediate_loader(void)
     module_t *m;
     void *kernel_image;
     size_t kernel_size;
-    void *initrd_image;
-    size_t initrd_size;
+    static linux_initrd_t initrds[LINUX_MAX_INITRDS];
+    unsigned int nr_initrds;
     uint64_t base;
     uint64_t size;
 
@@ -514,6 +532,13 @@ bool prepare_intermediate_loader(void)
             error_action(SL_ERR_FATAL);
     }
 
+    /* the boot timeline record is always written and is left for the kernel */
+    base = SLEXEC_TIMELINE_ADDR;
+    size = SLEXEC_TIMELINE_SIZE;
+    printk(SLEXEC_INFO"reserving SLEXEC boot timeline (%Lx - %Lx) in e820 table\n", base, (base + size - 1));
+    if ( !e820_protect_region(base, size, E820_RESERVED) )
+        error_action(SL_ERR_FATAL);
+
     /* replace map in loader context with copy */
     replace_e820_map(g_ldr_ctx);
     printk(SLEXEC_ERR"adjusted e820 map:\n");
@@ -523,10 +548,17 @@ bool prepare_intermediate_loader(void)
         return false;
 
     /* found SINITs/LCPs or SKL module earlier, remove them it from MBI */
-    if ( get_architecture() == SL_ARCH_TXT )
-        remove_txt_modules(g_ldr_ctx);
-    else if ( get_architecture() == SL_ARCH_SKINIT )
-        remove_module(g_ldr_ctx, g_skl_module);
+    if ( get_architecture() == SL_ARCH_TXT ) {
+        if ( !remove_txt_modules(g_ldr_ctx) )
+            return false;
+    }
+    else if ( get_architecture() == SL_ARCH_SKINIT ) {
+        /* g_skl_module points at the relocated copy by now */
+        if ( remove_module(g_ldr_ctx, g_skl_mod_start) == NULL ) {
+            printk(SLEXEC_ERR"failed to remove SKL module from module list\n");
+            return false;
+        }
+    }
 
     printk(SLEXEC_INFO"Assuming Intermediate Loader kernel is Linux format\n");
 
@@ -545,18 +577,26 @@ bool prepare_intermediate_loader(void)
     if ( kernel_image == NULL )
         return false;
 
-    if ( get_module_count(g_ldr_ctx) == 0 ) {
-        initrd_size = 0;
-        initrd_image = 0;
+    /*
+     * the SINIT and SKL modules are gone by now, so every module left is a
+     * piece of the initrd, in the order given
+     */
+    nr_initrds = get_module_count(g_ldr_ctx);
+    if ( nr_initrds > LINUX_MAX_INITRDS ) {
+        printk(SLEXEC_ERR"Error: too many initrd modules (%u, max %u)\n",
+               nr_initrds, LINUX_MAX_INITRDS);
+        return false;
     }
-    else {
-        m = get_module(g_ldr_ctx, 0);
-        initrd_image = (void *)m->mod_start;
-        initrd_size = m->mod_end - m->mod_start;
+    for ( unsigned int i = 0; i < nr_initrds; i++ ) {
+        m = get_module(g_ldr_ctx, i);
+        initrds[i].image = (void *)m->mod_start;
+        initrds[i].size = m->mod_end - m->mod_start;
+        printk(SLEXEC_INFO"initrd module %u: 0x%x (0x%x bytes)\n", i + 1,
+               m->mod_start, m->mod_end - m->mod_start);
     }
 
     return expand_linux_image(kernel_image, kernel_size,
-                              initrd_image, initrd_size);
+                              initrds, nr_initrds);
 }
 
 char *get_module_cmd(loader_ctx *lctx, module_t *mod)
@@ -590,8 +630,9 @@ char *get_cmdline(loader_ctx *lctx)
         }
     } else {
         /* currently must be type  2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_CMDLINE);
+        struct mb2_tag *start = get_mb2_tag(MB2_TAG_TYPE_CMDLINE);
+        if (start != NULL && g_mb2_edits.cmdline != NULL)
+            return (char *) g_mb2_edits.cmdline;
         if (start != NULL){
             struct mb2_tag_string *cmd = (struct mb2_tag_string *) start;
             return (char *) &(cmd->string);
@@ -608,9 +649,7 @@ bool have_loader_memlimits(loader_ctx *lctx)
         return (((multiboot_info_t *)lctx->addr)->flags & MBI_MEMLIMITS) != 0;
     } else {
         /* currently must be type 2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_MEMLIMITS);
-        return (start != NULL);
+        return (get_mb2_tag(MB2_TAG_TYPE_MEMLIMITS) != NULL);
     }
 }
 
@@ -622,8 +661,7 @@ uint32_t get_loader_mem_lower(loader_ctx *lctx)
         return ((multiboot_info_t *)lctx->addr)->mem_lower;
     }
     /* currently must be type 2 */
-    struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-    start = find_mb2_tag_type(start, MB2_TAG_TYPE_MEMLIMITS);
+    struct mb2_tag *start = get_mb2_tag(MB2_TAG_TYPE_MEMLIMITS);
     if (start != NULL){
         struct mb2_tag_memlimits *lim = (struct mb2_tag_memlimits *) start;
         return lim->mem_lower;
@@ -639,8 +677,7 @@ uint32_t get_loader_mem_upper(loader_ctx *lctx)
         return ((multiboot_info_t *)lctx->addr)->mem_upper;
     }
     /* currently must be type 2 */
-    struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-    start = find_mb2_tag_type(start, MB2_TAG_TYPE_MEMLIMITS);
+    struct mb2_tag *start = get_mb2_tag(MB2_TAG_TYPE_MEMLIMITS);
     if (start != NULL){
         struct mb2_tag_memlimits *lim = (struct mb2_tag_memlimits *) start;
         return lim->mem_upper;
@@ -656,16 +693,7 @@ unsigned int get_module_count(loader_ctx *lctx)
         return(((multiboot_info_t *) lctx->addr)->mods_count);
     } else {
         /* currently must be type 2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        unsigned int count = 0;
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_MODULE);
-        while (start != NULL){
-            count++;
-            /* nudge off this guy */
-            start = next_mb2_tag(start);
-            start = find_mb2_tag_type(start, MB2_TAG_TYPE_MODULE);
-        }
-        return count;
+        return g_mb2_index.nr_mods;
     }
 }
 
@@ -677,9 +705,7 @@ bool have_loader_memmap(loader_ctx *lctx)
         return (((multiboot_info_t *) lctx->addr)->flags & MBI_MEMMAP) != 0;
     } else {
         /* currently must be type 2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_MMAP);
-        return (start != NULL);
+        return (get_mb2_tag(MB2_TAG_TYPE_MMAP) != NULL);
     }
 }
 
@@ -692,8 +718,9 @@ memory_map_t *get_loader_memmap(loader_ctx *lctx)
         return (memory_map_t *)((multiboot_info_t *) lctx->addr)->mmap_addr;
     } else {
         /* currently must be type 2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_MMAP);
+        struct mb2_tag *start = get_mb2_tag(MB2_TAG_TYPE_MMAP);
+        if (start != NULL && g_mb2_edits.e820_copy)
+            return get_e820_copy();
         if (start != NULL){
             struct mb2_tag_mmap *mmap = (struct mb2_tag_mmap *) start;
             /* note here: the MB2 mem entries start with the 64-bit address.
@@ -716,8 +743,9 @@ uint32_t get_loader_memmap_length(loader_ctx *lctx)
         return (uint32_t)((multiboot_info_t *) lctx->addr)->mmap_length;
     } else {
         /* currently must be type 2 */
-        struct mb2_tag *start = (struct mb2_tag *)(lctx->addr + 8);
-        start = find_mb2_tag_type(start, MB2_TAG_TYPE_MMAP);
+        struct mb2_tag *start = get_mb2_tag(MB2_TAG_TYPE_MMAP);
+        if (start != NULL && g_mb2_edits.e820_copy)
+            return get_nr_map() * sizeof(memory_map_t);
         if (start != NULL){
             struct mb2_tag_mmap *mmap = (struct mb2_tag_mmap *) start;
             /* mmap->size is the size of the whole tag.  We have 16 bytes
@@ -745,8 +773,8 @@ get_loader_ctx_end(loader_ctx *lctx)
 }
 
 /*
- * will go through all modules to find an SINIT that matches the platform
- * (size can be NULL)
+ * will go through all modules to find the newest SINIT that matches the
+ * platform, so multi-platform ACM bundles pick the same one every boot
  */
 bool
 find_sinit_module(loader_ctx *lctx)
@@ -763,29 +791,35 @@ find_sinit_module(loader_ctx *lctx)
 
     printk(SLEXEC_ERR"module count: %d\n", (int)i);
 
-    /* run loop backwards */
-    for (  i -= 1; i > 0; i-- ) {
+    g_sinit_module = NULL;
+    g_sinit_size = 0;
+
+    /* the first module is the kernel */
+    for ( i = 1; i < get_module_count(lctx); i++ ) {
         m = get_module(lctx, i);
-        if (lctx->type == 1)
-            printk(SLEXEC_DETA
-                   "checking if module %s is an SINIT for this platform...\n",
-                   (const char *)m->string);
-        if (lctx->type == 2)
-            printk(SLEXEC_DETA
-                   "checking if module %s is an SINIT for this platform...\n",
-                   (const char *)&(m->string));
+        printk(SLEXEC_DETA
+               "checking if module %s is an SINIT for this platform...\n",
+               get_module_cmd(lctx, m));
 
         base = (void *)m->mod_start;
         size = m->mod_end - (unsigned long)(base);
-        if ( is_sinit_acmod(base, size, false) &&
-             does_acmod_match_platform((acm_hdr_t *)base) ) {
+        if ( !is_sinit_acmod(base, size, true) ||
+             !does_acmod_match_platform((acm_hdr_t *)base) )
+            continue;
+
+        printk(SLEXEC_DETA"SINIT matches platform, date: %x, TXT SVN: %u\n",
+               ((acm_hdr_t *)base)->date, ((acm_hdr_t *)base)->txt_svn);
+        if ( is_acmod_newer((acm_hdr_t *)base, g_sinit_module) ) {
             g_sinit_module = (acm_hdr_t *)base;
             g_sinit_size = size;
-            printk(SLEXEC_DETA"SINIT matches platform\n");
-            return true;
         }
     }
 
+    if ( g_sinit_module != NULL ) {
+        printk(SLEXEC_INFO"using SINIT with date %x\n", g_sinit_module->date);
+        return true;
+    }
+
     /* no SINIT found for this platform */
     printk(SLEXEC_ERR"no SINIT AC module found\n");
     return false;
@@ -820,6 +854,7 @@ find_skl_module(loader_ctx *lctx)
         size = m->mod_end - (unsigned long)(base);
         if ( is_skl_module(base, size) ){
             g_skl_module = (sl_header_t *)base;
+            g_skl_mod_start = base;
             g_skl_size = size;
             printk(SLEXEC_ERR"SKL module found\n");
             return true;
@@ -846,43 +881,12 @@ replace_e820_map(loader_ctx *lctx)
         return;
     } else {
         /* currently must be type 2 */
-        memory_map_t *old, *new;
-        uint32_t i;
-        uint32_t old_memmap_size = get_loader_memmap_length(lctx);
-        uint32_t old_memmap_entry_count =
-            old_memmap_size / sizeof(memory_map_t);
-        if (old_memmap_entry_count < (get_nr_map())){
-            /* we have to grow */
-            struct mb2_tag *map = (struct mb2_tag *)(lctx->addr + 8);
-            map = find_mb2_tag_type(map, MB2_TAG_TYPE_MMAP);
-            if (map == NULL){
-                printk(SLEXEC_ERR"MB2 map not found\n");
-                return;
-            }
-            if (false ==
-                grow_mb2_tag(lctx, map,
-                             sizeof(memory_map_t) *
-                             ((get_nr_map()) - old_memmap_entry_count))){
-                printk(SLEXEC_ERR"MB2 failed to grow e820 map tag\n");
-                return;
-            }
-        }
-        /* copy in new data */
-        {
-            /* RLM: for now, we'll leave the entries in MB1 format (with real
-             * size).  That may need revisited.
-             */
-            new = get_e820_copy();
-            old = get_loader_memmap(lctx);
-            if ( old == NULL ) {
-                printk(SLEXEC_ERR"old memory map not found\n");
-                return;
-            }
-            for (i = 0; i < (get_nr_map()); i++){
-                *old = *new;
-                old++, new++;
-            }
+        if (get_mb2_tag(MB2_TAG_TYPE_MMAP) == NULL){
+            printk(SLEXEC_ERR"MB2 map not found\n");
+            return;
         }
+        /* the copy goes in when the MBI is rewritten */
+        g_mb2_edits.e820_copy = true;
         /*
            printk(SLEXEC_INFO"AFTER replace_e820_map, loader context:\n");
            print_loader_ctx(lctx);
@@ -934,7 +938,6 @@ void print_loader_ctx(loader_ctx *lctx)
 uint8_t
 *get_loader_rsdp(loader_ctx *lctx, uint32_t *length)
 {
-    struct mb2_tag *start;
     struct mb2_tag_new_acpi *new_acpi;
 
     if (LOADER_CTX_BAD(lctx))
@@ -944,13 +947,12 @@ uint8_t
     if (length == NULL)
         return NULL;
 
-    start = (struct mb2_tag *) (lctx->addr + 8);
     new_acpi = (struct mb2_tag_new_acpi *)
-        find_mb2_tag_type(start, MB2_TAG_TYPE_ACPI_NEW);
+        get_mb2_tag(MB2_TAG_TYPE_ACPI_NEW);
     if (new_acpi == NULL){
         /* we'll try the old type--the tag structs are the same */
         new_acpi = (struct mb2_tag_new_acpi *)
-            find_mb2_tag_type(start, MB2_TAG_TYPE_ACPI_OLD);
+            get_mb2_tag(MB2_TAG_TYPE_ACPI_OLD);
         if (new_acpi == NULL)
             return NULL;
     }
@@ -961,22 +963,21 @@ uint8_t
 bool
 get_loader_efi_ptr(loader_ctx *lctx, uint32_t *address, uint64_t *long_address)
 {
-    struct mb2_tag *start, *hit;
+    struct mb2_tag *hit;
     struct mb2_tag_efi32 *efi32;
     struct mb2_tag_efi64 *efi64;
     if (LOADER_CTX_BAD(lctx))
         return false;
     if (lctx->type != MB2_ONLY)
         return false;
-    start = (struct mb2_tag *)(lctx->addr + 8);
-    hit = find_mb2_tag_type(start, MB2_TAG_TYPE_EFI32);
+    hit = get_mb2_tag(MB2_TAG_TYPE_EFI32);
     if (hit != NULL){
         efi32 = (struct mb2_tag_efi32 *) hit;
         *address = (uint32_t) efi32->pointer;
         *long_address = 0;
         return true;
     }
-    hit = find_mb2_tag_type(start, MB2_TAG_TYPE_EFI64);
+    hit = get_mb2_tag(MB2_TAG_TYPE_EFI64);
     if (hit != NULL){
         efi64 = (struct mb2_tag_efi64 *) hit;
         *long_address = (uint64_t) efi64->pointer;
@@ -989,11 +990,12 @@ get_loader_efi_ptr(loader_ctx *lctx, uint32_t *address, uint64_t *long_address)
 uint32_t
 find_efi_memmap(loader_ctx *lctx, uint32_t *descr_size,
                 uint32_t *descr_vers, uint32_t *mmap_size) {
-    struct mb2_tag *start = NULL, *hit = NULL;
+    struct mb2_tag *hit = NULL;
     struct mb2_tag_efi_mmap *efi_mmap = NULL;
 
-    start = (struct mb2_tag *)(lctx->addr + 8);
-    hit = find_mb2_tag_type(start, MB2_TAG_TYPE_EFI_MMAP);
+    if (LOADER_CTX_BAD(lctx) || lctx->type != MB2_ONLY)
+        return 0;
+    hit = get_mb2_tag(MB2_TAG_TYPE_EFI_MMAP);
     if (hit == NULL) {
        return 0;
     }
@@ -1027,8 +1029,7 @@ void load_framebuffer_info(loader_ctx *lctx, void *vscr)
         return;
     if (LOADER_CTX_BAD(lctx))
         return;
-    start = (struct mb2_tag *)(lctx->addr + 8);
-    start = find_mb2_tag_type(start, MB2_TAG_TYPE_FRAMEBUFFER);
+    start = get_mb2_tag(MB2_TAG_TYPE_FRAMEBUFFER);
     if (start != NULL){
         struct mb2_fb *mbf = (struct mb2_fb *) start;
         scr->lfb_base = (uint32_t) mbf->common.fb_addr;
@@ -1078,34 +1079,38 @@ void determine_loader_type(void *addr, uint32_t magic)
             break;
         case MB2_LOADER_MAGIC:
             g_ldr_ctx->type = MB2_ONLY;
-            /* save the original MB2 info size, since we have
-             * to put updates inline
-             */
-            g_mb_orig_size = *(uint32_t *) addr;
-
             {
-                void *mb2_reloc;
+                uint32_t mb2_size = *(uint32_t *) addr;
 
-                /* Since GRUB is sticking the MB2 structure very close to the
-                 * default location for the kernel, move it just below the SLEXEC
-                 * image.
+                /* GRUB may stick the MB2 structure close to the default
+                 * location for the kernel, but it is only read until
+                 * rewrite_loader_ctx() puts the edited copy somewhere
+                 * safe. Our own fixed low memory blocks are written before
+                 * that though, so move it out of their way if need be.
                  */
-                mb2_reloc = (void*)PAGE_DOWN(SLEXEC_BASE_ADDR - g_mb_orig_size);
-                sl_memcpy(mb2_reloc, addr, g_mb_orig_size);
-                g_ldr_ctx->addr = mb2_reloc;
-                addr = mb2_reloc;
-                printk(SLEXEC_INFO"MB2 relocated to: %p size: %x\n",
-                       addr, g_mb_orig_size);
+                if ( (uint32_t)addr < SLEXEC_TIMELINE_ADDR + SLEXEC_TIMELINE_SIZE
+                     && (uint32_t)addr + mb2_size > SLEXEC_SERIAL_LOG_ADDR ) {
+                    void *mb2_reloc =
+                        (void *)PAGE_DOWN(SLEXEC_BASE_ADDR - mb2_size);
+                    sl_memcpy(mb2_reloc, addr, mb2_size);
+                    g_ldr_ctx->addr = mb2_reloc;
+                    printk(SLEXEC_INFO"MB2 relocated to: %p size: %x\n",
+                           mb2_reloc, mb2_size);
+                }
+
+                if ( !mb2_index_build(g_ldr_ctx) ) {
+                    g_ldr_ctx->type = 0;
+                    break;
+                }
 
                 /* we may as well do this here--if we received an ELF
                  * sections tag, we won't use it, and it's useless to
                  * Xen downstream, since it's OUR ELF sections, not Xen's
                  */
                 struct mb2_tag *start =
-                    (struct mb2_tag *)(addr + 8);
-                start = find_mb2_tag_type(start, MB2_TAG_TYPE_ELF_SECTIONS);
+                    get_mb2_tag(MB2_TAG_TYPE_ELF_SECTIONS);
                 if (start != NULL)
-                    (void) remove_mb2_tag(g_ldr_ctx, start);
+                    (void) remove_mb2_tag(start);
             }
             break;
         default:
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_LOADER
+
+#include <types.h>
+#include <stdbool.h>
+#include <slexec.h>
+#include <stdarg.h>
+#include <string.h>
+#include <printk.h>
+#include <lz4.h>
+
+/*
+ * LZ4 frame decompression, for modules that are loaded compressed and
+ * expanded straight into their final location. Dictionaries are not
+ * supported and checksums are skipped: whatever we produce is measured
+ * later on anyway.
+ */
+
+#define LZ4_FLG_VERSION_MASK         0xC0
+#define LZ4_FLG_VERSION              0x40
+#define LZ4_FLG_BLOCK_CHECKSUM       0x10
+#define LZ4_FLG_CONTENT_SIZE         0x08
+#define LZ4_FLG_CONTENT_CHECKSUM     0x04
+#define LZ4_FLG_DICT_ID              0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED       0x80000000
+#define LZ4_MIN_MATCH                4
+#define LZ4_MAX_LENGTH               0x7fffffff
+
+typedef struct {
+    const uint8_t *blocks;      /* first block */
+    const uint8_t *end;
+    uint8_t flags;
+    uint64_t content_size;      /* 0 = not given in the header */
+} lz4_frame_t;
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool parse_header(const void *src, size_t size, lz4_frame_t *frame)
+{
+    const uint8_t *in = src;
+    size_t hdr_size = 7;
+
+    if ( size < hdr_size || get_le32(in) != LZ4_FRAME_MAGIC )
+        return false;
+
+    frame->flags = in[4];
+    if ( (frame->flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION ) {
+        printk(SLEXEC_ERR"LZ4 frame version not supported\n");
+        return false;
+    }
+    if ( frame->flags & LZ4_FLG_DICT_ID ) {
+        printk(SLEXEC_ERR"LZ4 frame dictionaries not supported\n");
+        return false;
+    }
+
+    frame->content_size = 0;
+    if ( frame->flags & LZ4_FLG_CONTENT_SIZE ) {
+        hdr_size += 8;
+        if ( size < hdr_size )
+            return false;
+        frame->content_size = get_le32(in + 6) |
+                              ((uint64_t)get_le32(in + 10) << 32);
+    }
+
+    /* magic, FLG, BD, [content size,] HC */
+    frame->blocks = in + hdr_size;
+    frame->end = in + size;
+    return true;
+}
+
+/* read an extended literal or match length */
+static bool get_length(const uint8_t **in, const uint8_t *in_end,
+                       size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if ( *in >= in_end || *len > LZ4_MAX_LENGTH )
+            return false;
+        b = *(*in)++;
+        *len += b;
+    } while ( b == 255 );
+
+    return true;
+}
+
+static void copy_match(uint8_t *d, size_t offset, size_t len)
+{
+    const uint8_t *s = d - offset;
+
+    if ( offset >= len ) {
+        sl_memcpy(d, s, len);
+        return;
+    }
+    /* overlapping: the match repeats the last <offset> bytes */
+    while ( len-- > 0 )
+        *d++ = *s++;
+}
+
+/*
+ * decode one compressed block at <out> + *pos, or only size it if <out> is
+ * NULL; matches may reach back into earlier blocks of the same frame
+ */
+static bool decode_block(const uint8_t *in, const uint8_t *in_end,
+                         uint8_t *out, size_t *pos, size_t out_size)
+{
+    while ( in < in_end ) {
+        unsigned int token = *in++;
+        size_t len = token >> 4;
+        size_t offset;
+
+        /* literals */
+        if ( len == 15 && !get_length(&in, in_end, &len) )
+            return false;
+        if ( len > (size_t)(in_end - in) || len > out_size - *pos )
+            return false;
+        if ( out != NULL )
+            sl_memcpy(out + *pos, in, len);
+        in += len;
+        *pos += len;
+
+        /* the last sequence has no match */
+        if ( in == in_end )
+            break;
+
+        /* match */
+        if ( in_end - in < 2 )
+            return false;
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        if ( offset == 0 || offset > *pos )
+            return false;
+        len = token & 0xf;
+        if ( len == 15 && !get_length(&in, in_end, &len) )
+            return false;
+        len += LZ4_MIN_MATCH;
+        if ( len > out_size - *pos )
+            return false;
+        if ( out != NULL )
+            copy_match(out + *pos, offset, len);
+        *pos += len;
+    }
+
+    return true;
+}
+
+/* run through all blocks of <frame>, decoding them to <out> if not NULL */
+static bool walk_frame(const lz4_frame_t *frame, uint8_t *out,
+                       size_t *pos, size_t out_size)
+{
+    const uint8_t *in = frame->blocks;
+    size_t checksum = (frame->flags & LZ4_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+
+    *pos = 0;
+    for ( ;; ) {
+        uint32_t block;
+        size_t len;
+
+        if ( frame->end - in < 4 )
+            return false;
+        block = get_le32(in);
+        in += 4;
+        /* end mark */
+        if ( block == 0 )
+            return true;
+
+        len = block & ~LZ4_BLOCK_UNCOMPRESSED;
+        if ( len + checksum > (size_t)(frame->end - in) )
+            return false;
+        if ( block & LZ4_BLOCK_UNCOMPRESSED ) {
+            if ( len > out_size - *pos )
+                return false;
+            if ( out != NULL )
+                sl_memcpy(out + *pos, in, len);
+            *pos += len;
+        }
+        else if ( !decode_block(in, in + len, out, pos, out_size) )
+            return false;
+        in += len + checksum;
+    }
+}
+
+bool is_lz4_frame(const void *src, size_t size)
+{
+    return size >= 4 && get_le32(src) == LZ4_FRAME_MAGIC;
+}
+
+/*
+ * lz4_frame_decoded_size
+ *
+ * Size of the data in the frame, from its header if it has it there, else
+ * by going over the blocks without writing anything out
+ *
+ * return:  0 = error (malformed or too big)
+ */
+size_t lz4_frame_decoded_size(const void *src, size_t size)
+{
+    lz4_frame_t frame;
+    size_t decoded;
+
+    if ( !parse_header(src, size, &frame) )
+        return 0;
+    if ( frame.flags & LZ4_FLG_CONTENT_SIZE )
+        return (frame.content_size > LZ4_MAX_LENGTH) ? 0 :
+                                                       frame.content_size;
+    if ( !walk_frame(&frame, NULL, &decoded, LZ4_MAX_LENGTH) )
+        return 0;
+    return decoded;
+}
+
+/*
+ * lz4_frame_decompress
+ *
+ * Decompresses the frame at <src> to <dst>, in one pass
+ *
+ * return:  size of the decompressed data, 0 = error
+ */
+size_t lz4_frame_decompress(const void *src, size_t size,
+                            void *dst, size_t dst_size)
+{
+    lz4_frame_t frame;
+    size_t decoded;
+
+    if ( !parse_header(src, size, &frame) ) {
+        printk(SLEXEC_ERR"bad LZ4 frame header\n");
+        return 0;
+    }
+    if ( !walk_frame(&frame, dst, &decoded, dst_size) ) {
+        printk(SLEXEC_ERR"corrupt LZ4 frame\n");
+        return 0;
+    }
+    return decoded;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
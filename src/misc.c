@@ -40,16 +40,58 @@
 #include <processor.h>
 #include <ctype.h>
 #include <misc.h>
+#include <loader.h>
+#include <acpi.h>
+#include <txt/smx.h>
+#include <txt/txt.h>
+#include <platform.h>
+
+#define HEX_ROW_BYTES    16
 
 /*
- * if 'prefix' != NULL, print it before each line of hex string
+ * dump a buffer as hex, formatting a whole 16-byte row per printk();
+ * if 'prefix' != NULL, each row is put on its own line starting with the
+ * prefix and the offset, and followed by an ASCII column
  */
 void print_hex(const char *prefix, const void *prtptr, size_t size)
 {
-    for ( size_t i = 0; i < size; i++ ) {
-        if ( i % 16 == 0 && prefix != NULL )
-            printk(SLEXEC_ERR"\n%s", prefix);
-        printk(SLEXEC_ERR"%02x ", *(uint8_t *)prtptr++);
+    static const char hexdig[] = "0123456789abcdef";
+    const uint8_t *bytes = prtptr;
+    /* "xx " per byte, then " |" ASCII "|" and the NULL */
+    char row[HEX_ROW_BYTES * 3 + 2 + HEX_ROW_BYTES + 2];
+
+    for ( size_t off = 0; off < size; off += HEX_ROW_BYTES ) {
+        size_t n = size - off < HEX_ROW_BYTES ? size - off : HEX_ROW_BYTES;
+        char *c = row;
+
+        for ( size_t i = 0; i < HEX_ROW_BYTES; i++ ) {
+            if ( i < n ) {
+                *c++ = hexdig[bytes[off + i] >> 4];
+                *c++ = hexdig[bytes[off + i] & 0xf];
+                *c++ = ' ';
+            }
+            else if ( prefix != NULL ) {
+                /* keep the ASCII column aligned on the last row */
+                *c++ = ' ';
+                *c++ = ' ';
+                *c++ = ' ';
+            }
+        }
+
+        if ( prefix == NULL ) {
+            *c = '\0';
+            printk(SLEXEC_ERR"%s", row);
+            continue;
+        }
+
+        *c++ = ' ';
+        *c++ = '|';
+        for ( size_t i = 0; i < n; i++ )
+            *c++ = ( bytes[off + i] >= 0x20 && bytes[off + i] < 0x7f ) ?
+                   (char)bytes[off + i] : '.';
+        *c++ = '|';
+        *c = '\0';
+        printk(SLEXEC_ERR"\n%s%04x: %s", prefix, (unsigned int)off, row);
     }
     printk(SLEXEC_ERR"\n");
 }
@@ -60,6 +102,146 @@ static uint64_t g_ticks_per_millisec;
 #define TIMER_FREQ	1193182
 #define TIMER_DIV(hz)	((TIMER_FREQ+(hz)/2)/(hz))
 
+#define PM_TIMER_FREQ	3579545
+/* reads before giving up on a PM timer that does not count */
+#define PM_TIMER_MAX_READS	1000000
+
+/* 64 by 32 bit division without needing __udivdi3 */
+static uint64_t div64_32(uint64_t n, uint32_t d)
+{
+    uint32_t high, low, hquo, lquo, rem;
+
+    high = n >> 32;
+    low = (uint32_t)n;
+    hquo = high / d;
+    rem = high % d;
+    asm volatile ( "divl %4;"
+                   : "=a"(lquo), "=d"(rem)
+                   : "a"(low), "d"(rem), "r"(d));
+
+    return ((uint64_t)hquo << 32) + lquo;
+}
+
+/* family 6 models from Sandy Bridge on, with MSR_PLATFORM_INFO over 100MHz */
+static bool has_100mhz_bclk(void)
+{
+    uint32_t eax = get_cpu_fms();
+    uint32_t model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+
+    if ( ((eax >> 8) & 0xf) != 6 || model < 0x2a )
+        return false;
+
+    switch ( model ) {
+        case 0x37:      /* Silvermont */
+        case 0x4a:
+        case 0x4d:
+        case 0x5a:
+        case 0x5d:
+        case 0x4c:      /* Airmont */
+            return false;
+        default:
+            return true;
+    }
+}
+
+/* the TSC rate the CPU reports about itself, 0 if it doesn't */
+static uint32_t tsc_khz_from_cpu(void)
+{
+    uint32_t regs[4];
+    uint32_t max_leaf = cpuid_eax(CPUID_X86_MANUFACTURER_LEAF);
+
+    if ( get_cpu_vendor() == CPU_VENDOR_INTEL ) {
+        /* TSC/crystal ratio and, when enumerated, the crystal rate */
+        if ( max_leaf >= CPUID_X86_TSC_LEAF ) {
+            do_cpuid(CPUID_X86_TSC_LEAF, regs);
+            if ( regs[0] != 0 && regs[1] != 0 && regs[2] != 0 )
+                return (regs[2] / 1000) * regs[1] / regs[0];
+        }
+
+        /* base frequency in MHz, which is what the TSC runs at */
+        if ( max_leaf >= CPUID_X86_FREQ_LEAF ) {
+            regs[0] = cpuid_eax(CPUID_X86_FREQ_LEAF) & 0xffff;
+            if ( regs[0] != 0 )
+                return regs[0] * 1000;
+        }
+
+        /*
+         * maximum non-turbo ratio, in units of the 100MHz bus clock; only
+         * trusted from Sandy Bridge on, older parts either lack the MSR or
+         * (Nehalem/Westmere) run a 133MHz one, as do the Silvermont and
+         * Airmont Atoms
+         */
+        if ( !has_100mhz_bclk() )
+            return 0;
+        regs[0] = (rdmsr(MSR_PLATFORM_INFO) >> 8) & 0xff;
+        return regs[0] * 100000;
+    }
+
+    if ( get_cpu_vendor() == CPU_VENDOR_AMD ) {
+        uint32_t family = (get_cpu_fms() >> 8) & 0xf;
+        uint64_t pstate;
+
+        if ( family == 0xf )
+            family += (get_cpu_fms() >> 20) & 0xff;
+
+        /* from family 17h on the TSC counts at the P0 frequency */
+        if ( family < 0x17 )
+            return 0;
+
+        pstate = rdmsr(MSR_AMD_PSTATE_DEF);
+        if ( !(pstate & AMD_PSTATE_EN) )
+            return 0;
+
+        if ( family >= 0x1a )
+            return (pstate & 0xfff) * 5 * 1000;
+
+        /* core COF = CpuFid * 200 / CpuDfsId MHz */
+        regs[0] = pstate & 0xff;
+        regs[1] = (pstate >> 8) & 0x3f;
+        if ( regs[1] == 0 )
+            return 0;
+        return regs[0] * 200 * 1000 / regs[1];
+    }
+
+    return 0;
+}
+
+/* count TSC ticks over ~1ms of the ACPI PM timer, 0 if there isn't one */
+static uint64_t tsc_ticks_from_pm_timer(void)
+{
+    bool ext = false;
+    uint16_t port = get_acpi_pm_timer(&ext);
+    uint32_t mask = ext ? 0xffffffff : 0xffffff;
+    uint32_t start_pm, pm, delta = 0;
+    uint64_t start, end;
+    unsigned int reads = 0;
+
+    if ( port == 0 )
+        return 0;
+
+    /* start on a timer edge */
+    start_pm = inl(port) & mask;
+    do {
+        pm = inl(port) & mask;
+        if ( ++reads > PM_TIMER_MAX_READS )
+            return 0;
+    } while ( pm == start_pm );
+
+    start = rdtsc();
+    start_pm = pm;
+    do {
+        pm = inl(port) & mask;
+        delta = (pm - start_pm) & mask;
+        if ( ++reads > PM_TIMER_MAX_READS )
+            return 0;
+    } while ( delta < PM_TIMER_FREQ / 1000 );
+    end = rdtsc();
+
+    if ( (end - start) >> 32 )
+        return 0;
+    return div64_32((end - start) * PM_TIMER_FREQ, delta * 1000);
+}
+
 static void wait_tsc_uip(void)
 {
     do {
@@ -72,11 +254,9 @@ static void wait_tsc_uip(void)
     } while ( inb(0x42) & 0x80 );
 }
 
-static void calibrate_tsc(void)
+/* count TSC ticks over one 1ms period of PIT channel 2 */
+static uint64_t tsc_ticks_from_pit(void)
 {
-    if ( g_calibrated )
-        return;
-
     /* disable speeker */
     uint8_t val = inb(0x61);
     val = ((val & ~0x2) | 0x1);
@@ -108,13 +288,29 @@ static void calibrate_tsc(void)
 
     uint64_t end = rdtsc();
 
-    /* # ticks in 1 millisecond */
-    g_ticks_per_millisec = end - start;
-
     /* restore timer 1 programming */
     outb(0x43, 0x54);
     outb(0x41, 0x12);
 
+    /* # ticks in 1 millisecond */
+    return end - start;
+}
+
+/*
+ * The CPU knows its own TSC rate on anything recent, so ask it first and
+ * only time the TSC against the ACPI PM timer or the PIT if it doesn't.
+ */
+static void calibrate_tsc(void)
+{
+    if ( g_calibrated )
+        return;
+
+    g_ticks_per_millisec = tsc_khz_from_cpu();
+    if ( g_ticks_per_millisec == 0 )
+        g_ticks_per_millisec = tsc_ticks_from_pm_timer();
+    if ( g_ticks_per_millisec == 0 )
+        g_ticks_per_millisec = tsc_ticks_from_pit();
+
     g_calibrated = true;
 }
 
@@ -134,6 +330,25 @@ void delay(int millisecs)
     }
 }
 
+uint64_t get_tsc_ticks_per_millisec(void)
+{
+    calibrate_tsc();
+    return g_ticks_per_millisec;
+}
+
+/* convert a TSC delta to microseconds without needing __udivdi3 */
+uint64_t tsc_to_usecs(uint64_t ticks)
+{
+    uint32_t ticks_per_usec;
+
+    calibrate_tsc();
+    ticks_per_usec = (uint32_t)g_ticks_per_millisec / 1000;
+    if ( ticks_per_usec == 0 )
+        return 0;
+
+    return div64_32(ticks, ticks_per_usec);
+}
+
 /* used by isXXX() in ctype.h */
 /* originally from:
  * http://fxr.watson.org/fxr/source/dist/acpica/utclib.c?v=NETBSD5
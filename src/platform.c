@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <types.h>
+#include <stdbool.h>
+#include <slexec.h>
+#include <string.h>
+#include <printk.h>
+#include <processor.h>
+#include <loader.h>
+#include <txt/smx.h>
+#include <txt/txt.h>
+#include <platform.h>
+
+static platform_info_t g_platform;
+static bool g_platform_valid;
+
+/* vendor[] is CPUID leaf 0 EBX, EDX, ECX */
+static unsigned int vendor_of(const uint32_t *vendor)
+{
+    if ( vendor[0] == 0x756e6547 &&             /* "Genu" */
+         vendor[1] == 0x49656e69 &&             /* "ineI" */
+         vendor[2] == 0x6c65746e )              /* "ntel" */
+        return CPU_VENDOR_INTEL;
+    if ( vendor[0] == 0x68747541 &&             /* "Auth" */
+         vendor[1] == 0x69746e65 &&             /* "enti" */
+         vendor[2] == 0x444d4163 )              /* "cAMD" */
+        return CPU_VENDOR_AMD;
+
+    return CPU_VENDOR_OTHER;
+}
+
+static bool is_intel(void)
+{
+    return vendor_of(g_platform.vendor) == CPU_VENDOR_INTEL;
+}
+
+/* GETSEC needs CR4.SMXE, which is left the way it was found */
+static void read_txt_info(void)
+{
+    unsigned long cr4 = read_cr4();
+
+    write_cr4(cr4 | CR4_SMXE);
+
+    g_platform.getsec_caps = __getsec_capabilities(0);
+    if ( g_platform.getsec_caps.chipset_present &&
+         smx_get_parameters(&g_platform.getsec_params) ) {
+        g_platform.didvid._raw = read_pub_config_reg(TXTCR_DIDVID);
+        g_platform.ver._raw = read_pub_config_reg(TXTCR_VER_FSBIF);
+        if ( (g_platform.ver._raw & 0xffffffff) == 0xffffffff ||
+             (g_platform.ver._raw & 0xffffffff) == 0x00 ) /* need to use VER.QPIIF */
+            g_platform.ver._raw = read_pub_config_reg(TXTCR_VER_QPIIF);
+        g_platform.sinit_base = read_pub_config_reg(TXTCR_SINIT_BASE);
+        g_platform.sinit_size = read_pub_config_reg(TXTCR_SINIT_SIZE);
+        g_platform.heap_base = read_pub_config_reg(TXTCR_HEAP_BASE);
+        g_platform.heap_size = read_pub_config_reg(TXTCR_HEAP_SIZE);
+        g_platform.txt_valid = true;
+    }
+
+    write_cr4(cr4);
+}
+
+/*
+ * take the platform snapshot; CPUID has to be known to work already
+ */
+void init_platform_info(void)
+{
+    uint32_t regs[4];
+
+    if ( g_platform_valid )
+        return;
+
+    sl_memset(&g_platform, 0, sizeof(g_platform));
+
+    do_cpuid(CPUID_X86_MANUFACTURER_LEAF, regs);
+    g_platform.max_leaf = regs[0];
+    g_platform.vendor[0] = regs[1];
+    g_platform.vendor[1] = regs[3];
+    g_platform.vendor[2] = regs[2];
+    g_platform.max_ext_leaf = cpuid_eax(0x80000000);
+
+    g_platform.fms = cpuid_eax(CPUID_X86_FEATURE_INFO_LEAF);
+    g_platform.feat_ecx = cpuid_ecx(CPUID_X86_FEATURE_INFO_LEAF);
+    if ( g_platform.max_leaf >= CPUID_X86_EXT_FEATURE_LEAF )
+        g_platform.ext_feat_ebx = cpuid_ebx1(CPUID_X86_EXT_FEATURE_LEAF, 0);
+    if ( g_platform.max_ext_leaf >= CPUID_X86_EXT_FEATURE_INFO_LEAF )
+        g_platform.ext_info_ecx = cpuid_ecx(CPUID_X86_EXT_FEATURE_INFO_LEAF);
+
+    g_platform.apic_base = rdmsr(MSR_IA32_APICBASE);
+    g_platform.mcg_cap = rdmsr(MSR_IA32_MCG_CAP);
+
+    if ( is_intel() ) {
+        g_platform.platform_id = rdmsr(MSR_IA32_PLATFORM_ID);
+        if ( g_platform.feat_ecx & (CPUID_X86_FEATURE_VMX |
+                                    CPUID_X86_FEATURE_SMX) )
+            g_platform.feat_ctrl = rdmsr(MSR_IA32_FEATURE_CONTROL);
+        if ( g_platform.ext_feat_ebx & CPUID_X86_FEATURE_SGX )
+            g_platform.sgx_svn_status = rdmsr(MSR_IA32_SGX_SVN_STATUS);
+        if ( g_platform.feat_ecx & CPUID_X86_FEATURE_SMX )
+            read_txt_info();
+    }
+
+    g_platform_valid = true;
+}
+
+/*
+ * the one field slexec itself may change after the snapshot: a PERMISSIVE_BOOT
+ * build locks IA32_FEATURE_CONTROL when the BIOS didn't
+ */
+void update_platform_feat_ctrl(void)
+{
+    if ( g_platform_valid )
+        g_platform.feat_ctrl = rdmsr(MSR_IA32_FEATURE_CONTROL);
+}
+
+const platform_info_t *get_platform_info(void)
+{
+    return g_platform_valid ? &g_platform : NULL;
+}
+
+/*
+ * vendor and family/model/stepping from the snapshot, or straight from
+ * CPUID for callers (such as TSC calibration) that can run before it
+ */
+unsigned int get_cpu_vendor(void)
+{
+    uint32_t regs[4], vendor[3];
+
+    if ( g_platform_valid )
+        return vendor_of(g_platform.vendor);
+
+    do_cpuid(CPUID_X86_MANUFACTURER_LEAF, regs);
+    vendor[0] = regs[1];
+    vendor[1] = regs[3];
+    vendor[2] = regs[2];
+    return vendor_of(vendor);
+}
+
+uint32_t get_cpu_fms(void)
+{
+    if ( g_platform_valid )
+        return g_platform.fms;
+
+    return cpuid_eax(CPUID_X86_FEATURE_INFO_LEAF);
+}
+
+/* dump the snapshot to the log so it ends up in the memlog as well */
+void print_platform_info(void)
+{
+    const platform_info_t *p = &g_platform;
+
+    if ( !g_platform_valid )
+        return;
+
+    printk(SLEXEC_INFO"platform snapshot:\n");
+    printk(SLEXEC_INFO"\tCPUID max leaf: 0x%x, max ext leaf: 0x%x\n",
+           p->max_leaf, p->max_ext_leaf);
+    printk(SLEXEC_INFO"\tfamily/model/stepping: 0x%x\n", p->fms);
+    printk(SLEXEC_INFO"\tfeatures: 1.ecx 0x%x, 7.ebx 0x%x, 80000001.ecx 0x%x\n",
+           p->feat_ecx, p->ext_feat_ebx, p->ext_info_ecx);
+    printk(SLEXEC_INFO"\tAPIC base: 0x%Lx, MCG_CAP: 0x%Lx\n",
+           p->apic_base, p->mcg_cap);
+    if ( is_intel() )
+        printk(SLEXEC_INFO"\tfeature control: 0x%Lx, platform id: 0x%Lx, "
+               "SGX SVN status: 0x%Lx\n", p->feat_ctrl, p->platform_id,
+               p->sgx_svn_status);
+    if ( !p->txt_valid )
+        return;
+
+    printk(SLEXEC_INFO"\tGETSEC capabilities: 0x%x\n", p->getsec_caps._raw);
+    printk(SLEXEC_INFO"\tGETSEC parameters: max ACM size 0x%x, mem types 0x%x, "
+           "SENTER controls 0x%x, S-CRTM %u, preserve MCE %u\n",
+           p->getsec_params.acm_max_size, p->getsec_params.acm_mem_types,
+           p->getsec_params.senter_controls, p->getsec_params.proc_based_scrtm,
+           p->getsec_params.preserve_mce);
+    printk(SLEXEC_INFO"\tTXT DIDVID: 0x%Lx, VER: 0x%Lx\n",
+           p->didvid._raw, p->ver._raw);
+    printk(SLEXEC_INFO"\tTXT SINIT: 0x%Lx (0x%Lx), heap: 0x%Lx (0x%Lx)\n",
+           p->sinit_base, p->sinit_size, p->heap_base, p->heap_size);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -69,26 +69,45 @@ static void memlog_init(void)
         g_log->curr_pos = 0;
 }
 
-static void memlog_write(const char *str, unsigned int count)
+static void memlog_putc(char ch)
 {
-    if ( g_log == NULL || count > g_log->max_size )
+    if ( g_log == NULL || g_log->max_size < 2 )
         return;
 
-    /* wrap to beginning if too big to fit */
-    if ( g_log->curr_pos + count > g_log->max_size )
+    /* wrap to beginning if the log is full */
+    if ( g_log->curr_pos + 1 >= g_log->max_size )
         g_log->curr_pos = 0;
 
-    sl_memcpy(&g_log->buf[g_log->curr_pos], str, count);
-    g_log->curr_pos += count;
+    /* keep the log NULL-terminated; curr_pos points to the NULL so that */
+    /* it will be overwritten by the next char */
+    g_log->buf[g_log->curr_pos++] = ch;
+    g_log->buf[g_log->curr_pos] = '\0';
+}
 
-    /* if the string wasn't NULL-terminated, then NULL-terminate the log */
-    if ( str[count-1] != '\0' )
-        g_log->buf[g_log->curr_pos] = '\0';
-    else {
-        /* so that curr_pos will point to the NULL and be overwritten */
-        /* on next copy */
-        g_log->curr_pos--;
-    }
+static void vga_putc_sink(char ch)
+{
+    vga_putc(ch);
+}
+
+/*
+ * sinks that printk() output streams to, in the order they are written;
+ * built from g_log_targets once by printk_init() so that each char costs
+ * only the enabled sinks (before that, the default serial/VGA targets)
+ */
+typedef void (*log_sink_t)(char ch);
+
+static log_sink_t g_log_sinks[3] = { comc_putc, vga_putc_sink };
+static unsigned int g_nr_log_sinks = 2;
+
+static void init_log_sinks(void)
+{
+    g_nr_log_sinks = 0;
+    if ( g_log_targets & SLEXEC_LOG_TARGET_MEMORY )
+        g_log_sinks[g_nr_log_sinks++] = memlog_putc;
+    if ( g_log_targets & SLEXEC_LOG_TARGET_SERIAL )
+        g_log_sinks[g_nr_log_sinks++] = comc_putc;
+    if ( g_log_targets & SLEXEC_LOG_TARGET_VGA )
+        g_log_sinks[g_nr_log_sinks++] = vga_putc_sink;
 }
 
 void printk_init(void)
@@ -111,41 +130,42 @@ void printk_init(void)
         vga_init();
         get_slexec_vga_delay(); /* parse vga delay time */
     }
+
+    init_log_sinks();
 }
 
-#define WRITE_LOGS(s, n) \
-    do {                                                                 \
-        if (g_log_targets & SLEXEC_LOG_TARGET_MEMORY) memlog_write(s, n); \
-        if (g_log_targets & SLEXEC_LOG_TARGET_SERIAL) serial_write(s, n); \
-        if (g_log_targets & SLEXEC_LOG_TARGET_VGA) vga_write(s, n);       \
-    } while (0)
+static void write_log_sinks(char ch)
+{
+    for ( unsigned int i = 0; i < g_nr_log_sinks; i++ )
+        g_log_sinks[i](ch);
+}
 
-void printk(const char *fmt, ...)
+static void log_putc(char ch, void *ctx)
 {
-    char buf[256];
-    char *pbuf = buf;
-    int n;
-    va_list ap;
-    uint8_t log_level;
-    static bool last_line_cr = true;
+    static char last_char = '\n';
 
-    sl_memset(buf, '\0', sizeof(buf));
-    va_start(ap, fmt);
-    n = sl_vscnprintf(buf, sizeof(buf), fmt, ap);
+    (void)ctx;
 
-    log_level = get_loglvl_prefix(&pbuf, &n);
+    /* prepend "SLEXEC: " if the last line that was printed ended with a '\n' */
+    if ( last_char == '\n' ) {
+        for ( const char *prefix = "SLEXEC: "; *prefix != '\0'; prefix++ )
+            write_log_sinks(*prefix);
+    }
 
-    if ( !(g_log_level & log_level) )
-        goto exit;
+    write_log_sinks(ch);
+    last_char = ch;
+}
 
-    /* prepend "SLEXEC: " if the last line that was printed ended with a '\n' */
-    if ( last_line_cr )
-        WRITE_LOGS("SLEXEC: ", 8);
+void (printk)(const char *fmt, ...)
+{
+    va_list ap;
 
-    last_line_cr = (n > 0 && (*(pbuf+n-1) == '\n'));
-    WRITE_LOGS(pbuf, n);
+    /* drop filtered messages before paying for the formatting */
+    if ( !(g_log_level & get_loglvl_prefix(&fmt)) )
+        return;
 
-exit:
+    va_start(ap, fmt);
+    sl_vcbprintf(log_putc, NULL, fmt, ap);
     va_end(ap);
 }
 
@@ -30,6 +30,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_SKINIT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -41,49 +43,76 @@
 #include <loader.h>
 #include <e820.h>
 #include <linux.h>
+#include <timeline.h>
 #include <skinit/skl.h>
-
-/*
- * CPUID extended feature info
- */
-static unsigned int g_cpuid_ext_feat_info = 0;
+#include <txt/smx.h>
+#include <txt/txt.h>
+#include <platform.h>
 
 int supports_skinit(void)
 {
-    g_cpuid_ext_feat_info = cpuid_ecx(CPUID_X86_EXT_FEATURE_INFO_LEAF);
-
-    if (g_cpuid_ext_feat_info & CPUID_X86_EXT_FEATURE_SKINIT) {
+    if (get_platform_info()->ext_info_ecx & CPUID_X86_EXT_FEATURE_SKINIT) {
         printk(SLEXEC_INFO"SKINIT CPU and all needed capabilities present\n");
         return SL_ERR_NONE;
     }
     return SL_ERR_SKINIT_NOT_SUPPORTED;
 }
 
+/*
+ * Upper bound on waiting for the xAPIC to send the IPI, and the settle
+ * time used in x2APIC mode where the ICR has no delivery status. The MP
+ * spec allows 10ms for an AP to take an INIT.
+ */
+#define INIT_IPI_TIMEOUT_MS    10
+
 /* Broadcast INIT to all APs except self */
 static void send_init_ipi_shorthand(void)
 {
     uint32_t *icr_reg;
     uint32_t apic_base = get_apic_base();
+    uint64_t start, end, timeout;
+
+    timeout = INIT_IPI_TIMEOUT_MS * get_tsc_ticks_per_millisec();
 
     /* accessing the ICR depends on the APIC mode */
     if (apic_base & X2APIC_ENABLE) {
         mb();
 
         /* access ICR through MSR */
+        start = rdtsc();
         wrmsr(MSR_X2APIC_ICR, (ICR_DELIVER_EXCL_SELF|ICR_MODE_INIT));
         printk(SLEXEC_INFO"SKINIT assert #INIT on APs - x2APIC MSR reg: 0x%x\n", MSR_X2APIC_ICR);
+
+        /* no delivery status to look at, give the APs the full time */
+        do {
+            cpu_relax();
+            end = rdtsc();
+        } while ( end - start < timeout );
     } else {
         /* mask off low order bits to get base address */
         apic_base &= APICBASE_BASE_MASK;
         /* access ICR through MMIO */
         icr_reg = (uint32_t *)(apic_base + LAPIC_ICR_LO_OFFSET);
 
+        start = rdtsc();
         writel(icr_reg, (ICR_DELIVER_EXCL_SELF|ICR_MODE_INIT));
+
+        /* the local APIC clears the pending bit once the IPI is sent */
+        do {
+            cpu_relax();
+            end = rdtsc();
+            if ( !(readl(icr_reg) & ICR_DELIVERY_PENDING) )
+                break;
+        } while ( end - start < timeout );
+
         printk(SLEXEC_INFO"SKINIT assert #INIT on APs - xAPIC ICR reg: %p\n", icr_reg);
+        if ( readl(icr_reg) & ICR_DELIVERY_PENDING )
+            printk(SLEXEC_WARN"INIT IPI still pending after %ums\n",
+                   INIT_IPI_TIMEOUT_MS);
     }
 
-    printk(SLEXEC_INFO"Wait for IPI delivery\n");
-    delay(1000);
+    printk(SLEXEC_INFO"INIT IPI delivery took %Lu us\n",
+           tsc_to_usecs(end - start));
 }
 
 void skinit_launch_environment(void)
@@ -92,6 +121,9 @@ void skinit_launch_environment(void)
 
     send_init_ipi_shorthand();
 
+    timeline_end(BOOT_PHASE_LAUNCH);
+    print_timeline();
+
     disable_intr();
 
     printk(SLEXEC_INFO"SKINIT launch SKL - slb: 0x%x\n", slb);
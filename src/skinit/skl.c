@@ -30,6 +30,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_SKINIT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -53,6 +55,7 @@ skl_info_t skl_info = {
 };
 
 sl_header_t *g_skl_module = NULL;
+void *g_skl_mod_start = NULL;    /* where the loader put it */
 uint32_t g_skl_size = 0;
 
 bool is_skl_module(const void *skl_base, uint32_t skl_size)
@@ -79,14 +82,25 @@ bool is_skl_module(const void *skl_base, uint32_t skl_size)
     return true;
 }
 
-void relocate_skl_module(void)
+bool relocate_skl_module(void)
 {
-    void *dest = (void *)SLEXEC_FIXED_SKL_BASE;
+    uint64_t size = (g_skl_size > SKL_SLB_SIZE) ? g_skl_size : SKL_SLB_SIZE;
+    uint64_t base;
+    void *dest;
+
+    base = e820_alloc(size, SKL_SLB_SIZE, 0x100000000ULL,
+                      E820_ALLOC_TOP_DOWN, E820_RESERVED);
+    if ( base == 0 ) {
+        printk(SLEXEC_ERR"no memory below 4GB to relocate SKL module\n");
+        return false;
+    }
 
-    /* TODO hardcoded relocation for now */
+    dest = (void *)(uint32_t)base;
     sl_memcpy(dest, g_skl_module, g_skl_size);
     printk(SLEXEC_INFO"SKL relocated module from %p to %p\n", g_skl_module, dest);
     g_skl_module = dest;
+
+    return true;
 }
 
 void print_skl_module(void)
@@ -47,6 +47,7 @@
 #include <processor.h>
 #include <misc.h>
 #include <cmdline.h>
+#include <timeline.h>
 #include <e820.h>
 #include <linux.h>
 #include <tpm.h>
@@ -54,6 +55,7 @@
 #include <txt/mle.h>
 #include <txt/smx.h>
 #include <txt/txt.h>
+#include <platform.h>
 #include <txt/acmod.h>
 #include <skinit/skl.h>
 #include <skinit/skinit.h>
@@ -198,25 +200,21 @@ static bool prepare_cpu(void)
     }
 
     if (g_architecture == SL_ARCH_TXT) {
-        getsec_parameters_t params;
-        if ( !smx_get_parameters(&params) ) {
-            printk(SLEXEC_ERR"smx_get_parameters() failed\n");
-            return false;
-        }
+        const getsec_parameters_t *params = &get_platform_info()->getsec_params;
 
-        if ( params.preserve_mce )
+        if ( params->preserve_mce )
             printk(SLEXEC_INFO"TXT supports preserving machine check errors\n");
         else
             printk(SLEXEC_INFO"TXT no machine check errors\n");
 
-        if ( params.proc_based_scrtm )
+        if ( params->proc_based_scrtm )
             printk(SLEXEC_INFO"TXT CPU support processor-based S-CRTM\n");
 
-        preserve_mce = !!(params.preserve_mce);
+        preserve_mce = !!(params->preserve_mce);
     }
 
     /* check if all machine check regs are clear */
-    mcg_cap = rdmsr(MSR_IA32_MCG_CAP);
+    mcg_cap = get_platform_info()->mcg_cap;
     for ( unsigned int i = 0; i < (mcg_cap & 0xff); i++ ) {
         mcg_stat = rdmsr(MSR_IA32_MC0_STATUS + 4*i);
         if ( mcg_stat & (1ULL << 63) ) {
@@ -234,8 +232,6 @@ static bool prepare_cpu(void)
 static bool platform_architecture(void)
 {
     unsigned long f1, f2;
-     /* eax: regs[0], ebx: regs[1], ecx: regs[2], edx: regs[3] */
-    uint32_t regs[4];
 
     /* is CPUID supported? */
     /* (it's supported if ID flag in EFLAGS can be set and cleared) */
@@ -256,23 +252,21 @@ static bool platform_architecture(void)
         return false;
     }
 
-    do_cpuid(CPUID_X86_MANUFACTURER_LEAF, regs);
+    /* everything else about the platform comes from one snapshot */
+    init_platform_info();
 
-    if ( regs[1] == 0x756e6547        /* "Genu" */
-         && regs[2] == 0x6c65746e     /* "ntel" */
-         && regs[3] == 0x49656e69 ) { /* "ineI" */
-        printk(SLEXEC_INFO"Platform is Intel\n");
-        g_architecture = SL_ARCH_TXT;
-    }
-    else if ( regs[1] == 0x68747541   /* "Auth" */
-         && regs[2] == 0x444d4163     /* "cAMD" */
-         && regs[3] == 0x69746e65 ) { /* "enti" */
-        printk(SLEXEC_INFO"Platform is AMD\n");
-        g_architecture = SL_ARCH_SKINIT;
-    }
-    else {
-        printk(SLEXEC_ERR"Error: platform is neither Intel or AMD\n");
-        return false;
+    switch ( get_cpu_vendor() ) {
+        case CPU_VENDOR_INTEL:
+            printk(SLEXEC_INFO"Platform is Intel\n");
+            g_architecture = SL_ARCH_TXT;
+            break;
+        case CPU_VENDOR_AMD:
+            printk(SLEXEC_INFO"Platform is AMD\n");
+            g_architecture = SL_ARCH_SKINIT;
+            break;
+        default:
+            printk(SLEXEC_ERR"Error: platform is neither Intel or AMD\n");
+            return false;
     }
 
     return true;
@@ -281,11 +275,21 @@ static bool platform_architecture(void)
 void begin_launch(void *addr, uint32_t magic)
 {
     const char *cmdline;
+    uint64_t entry, loader_end;
     int err;
 
-    /* this is the SLEXEC module loader type, either MB1 or MB2 */
+    /*
+     * this is the SLEXEC module loader type, either MB1 or MB2; the MBI is
+     * moved out of our low memory here, so the timeline comes after it
+     */
+    entry = rdtsc();
     determine_loader_type(addr, magic);
+    loader_end = rdtsc();
+
+    timeline_init(entry);
+    timeline_record(BOOT_PHASE_LOADER, entry, loader_end);
 
+    timeline_start(BOOT_PHASE_CMDLINE);
     cmdline = get_cmdline(g_ldr_ctx);
     sl_memset(g_cmdline, '\0', sizeof(g_cmdline));
     if ( cmdline )
@@ -298,6 +302,7 @@ void begin_launch(void *addr, uint32_t magic)
 
     /* initialize all logging targets */
     printk_init();
+    timeline_end(BOOT_PHASE_CMDLINE);
 
     printk(SLEXEC_INFO"******************* SLEXEC *******************\n");
     printk(SLEXEC_INFO"   %s -- @ %p\n", SLEXEC_CHANGESET, _start);
@@ -307,13 +312,14 @@ void begin_launch(void *addr, uint32_t magic)
 
     if ( !platform_architecture() )
         error_action(SL_ERR_FATAL);
+    print_platform_info();
 
     slr_init_table((struct slr_table *)SLEXEC_SLR_TABLE_ADDR,
                    (g_architecture == SL_ARCH_TXT) ? SLR_INTEL_TXT : SLR_AMD_SKINIT,
                    SLEXEC_SLR_TABLE_SIZE);
 
     /* we should only be executing on the BSP */
-    g_apic_base = (uint32_t)rdmsr(MSR_IA32_APICBASE);
+    g_apic_base = (uint32_t)get_platform_info()->apic_base;
     if ( !(g_apic_base & APICBASE_BSP) ) {
         printk(SLEXEC_INFO"entry processor is not BSP\n");
         error_action(SL_ERR_FATAL);
@@ -321,12 +327,18 @@ void begin_launch(void *addr, uint32_t magic)
     printk(SLEXEC_INFO"BSP is cpu %u APIC base MSR: 0x%x\n", get_apicid(), g_apic_base);
 
     /* make copy of e820 map that we will use and adjust */
+    timeline_start(BOOT_PHASE_E820);
     if ( !copy_e820_map(g_ldr_ctx) )
         error_action(SL_ERR_FATAL);
+    if ( !e820_alloc_init(g_ldr_ctx) )
+        error_action(SL_ERR_FATAL);
+    timeline_end(BOOT_PHASE_E820);
 
     /* make TPM ready for measured launch */
+    timeline_start(BOOT_PHASE_TPM_DETECT);
     if ( !tpm_detect() )
        error_action(SL_ERR_TPM_NOT_READY);
+    timeline_end(BOOT_PHASE_TPM_DETECT);
 
     if (g_architecture == SL_ARCH_TXT) {
         /* we need to make sure this is a (TXT-) capable platform before using */
@@ -340,13 +352,18 @@ void begin_launch(void *addr, uint32_t magic)
         err = supports_txt();
         error_action(err);
 
+        timeline_start(BOOT_PHASE_SINIT);
         find_sinit_module(g_ldr_ctx);
         /* check if it is newer than BIOS provided version, then copy it to BIOS reserved region */
         g_sinit_module = copy_sinit(g_sinit_module);
         if (g_sinit_module == NULL)
             error_action(SL_ERR_SINIT_NOT_PRESENT);
+        timeline_end(BOOT_PHASE_SINIT);
+
+        timeline_start(BOOT_PHASE_ACM_VERIFY);
         if (!verify_acmod(g_sinit_module))
             error_action(SL_ERR_ACMOD_VERIFY_FAILED);
+        timeline_end(BOOT_PHASE_ACM_VERIFY);
 
         /* verify SE enablement status */
         verify_ia32_sgx_svn_status(g_sinit_module);
@@ -368,10 +385,13 @@ void begin_launch(void *addr, uint32_t magic)
         error_action(err);
 
         /* locate and load SKL module */
+        timeline_start(BOOT_PHASE_SKL);
         if ( !find_skl_module(g_ldr_ctx) )
             error_action(SL_ERR_NO_SKL);
 
-        relocate_skl_module();
+        if ( !relocate_skl_module() )
+            error_action(SL_ERR_FATAL);
+        timeline_end(BOOT_PHASE_SKL);
         print_skl_module();
     }
 
@@ -383,12 +403,24 @@ void begin_launch(void *addr, uint32_t magic)
     if ( !prepare_cpu() )
         error_action(SL_ERR_FATAL);
 
+    timeline_start(BOOT_PHASE_TPM_INIT);
     if ( !prepare_tpm() )
         error_action(SL_ERR_TPM_NOT_READY);
+    timeline_end(BOOT_PHASE_TPM_INIT);
+
+    /*
+     * the PMRs and the event log have to be settled before the e820 map
+     * is handed to the kernel
+     */
+    if ( g_architecture == SL_ARCH_TXT &&
+         (!txt_prepare_pmrs() || !txt_alloc_event_log()) )
+        error_action(SL_ERR_FATAL);
 
     /* locate and prepare the secure launch kernel */
+    timeline_start(BOOT_PHASE_KERNEL);
     if ( !prepare_intermediate_loader() )
         error_action(SL_ERR_FATAL);
+    timeline_end(BOOT_PHASE_KERNEL);
 
     if (g_architecture == SL_ARCH_TXT) {
         /* launch the measured environment */
@@ -397,6 +429,7 @@ void begin_launch(void *addr, uint32_t magic)
     }
     else {
         /* prepare the bootloader data area in the SKL */
+        timeline_start(BOOT_PHASE_LAUNCH);
         if ( !prepare_skl_bootloader_data() )
             error_action(SL_ERR_FATAL);
 
@@ -71,33 +71,25 @@ static bool div64(uint64_t num, uint32_t base, uint64_t *quot, uint32_t *rem)
     return true;
 }
 
-/*
- * write the character into the buffer
- * return the position of the buffer after writting
- */
-static unsigned long write_char_to_buffer(char *buf, size_t buf_len,
-                                          unsigned long buf_pos, char ch)
-{
-    /* check buffer overflow? */
-    if ( buf_pos >= buf_len )
-        return 0;
+/* output state of sl_vcbprintf(): the sink and the number of chars sent */
+typedef struct {
+    sl_putc_t putc;
+    void *ctx;
+    unsigned long count;
+} output_t;
 
-    *(buf + buf_pos) = ch;
-    return buf_pos + 1;
+/* send one character to the sink */
+static void write_char(output_t *out, char ch)
+{
+    out->putc(ch, out->ctx);
+    out->count++;
 }
 
-/*
- * write pad_len pads into the buffer
- * return the position of the buffer after writting
- */
-static unsigned long write_pads_to_buffer(char *buf, size_t buf_len,
-                                          unsigned long buf_pos, char pad,
-                                          size_t pad_len)
+/* send pad_len pads to the sink */
+static void write_pads(output_t *out, char pad, size_t pad_len)
 {
     for ( unsigned int i = 0; i < pad_len; i++ )
-        buf_pos = write_char_to_buffer(buf, buf_len, buf_pos, pad);
-
-    return buf_pos;
+        write_char(out, pad);
 }
 
 /* %[flags][width][.precision][length]specifier */
@@ -120,14 +112,9 @@ typedef struct {
     bool digit;
 } modifiers_t;
 
-/*
- * write the string into the buffer regarding flags
- * return the position of the buffer after writing
- */
-static unsigned long write_string_to_buffer(char *buf, size_t buf_len,
-                                            unsigned long buf_pos,
-                                            const char* str, size_t strlen,
-                                            modifiers_t *mods)
+/* send the string to the sink regarding flags */
+static void write_string(output_t *out, const char* str, size_t strlen,
+                         modifiers_t *mods)
 {
     unsigned int i;
 
@@ -137,31 +124,41 @@ static unsigned long write_string_to_buffer(char *buf, size_t buf_len,
     mods->width = ( mods->width > strlen ) ? mods->width - strlen : 0;
     if ( mods->flag & LEFT_ALIGNED ) { /* left align */
         for ( i = 0; i < strlen; i++ )
-            buf_pos = write_char_to_buffer(buf, buf_len, buf_pos, str[i]);
-        buf_pos = write_pads_to_buffer(buf, buf_len, buf_pos, ' ', mods->width);
+            write_char(out, str[i]);
+        write_pads(out, ' ', mods->width);
     }
     else { /* right align */
         /* if not digit, don't considering pad '0' */
         char pad = ( mods->digit && (mods->flag & ZERO_PADDED) ) ? '0' : ' ';
 
-        buf_pos = write_pads_to_buffer(buf, buf_len, buf_pos, pad, mods->width);
+        write_pads(out, pad, mods->width);
         for ( i = 0; i < strlen; i++ )
-            buf_pos = write_char_to_buffer(buf, buf_len, buf_pos, str[i]);
+            write_char(out, str[i]);
     }
-
-    return buf_pos;
 }
 
-/* convert a integer to a string regarding flags, qualifier, specifier, etc. */
+/* "00" .. "99": two decimal digits per table lookup */
+static const char dec_pairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/*
+ * convert a integer to a string regarding flags, qualifier, specifier, etc.
+ * hex and octal digits are taken with shift/mask; decimal digits two at a
+ * time with 32-bit divides, falling back to div64 only for the part of the
+ * value above 32 bits
+ */
 static size_t int2str(long long val, char *str, size_t strlen,
                       const modifiers_t *mods)
 {
-    unsigned int i;
     size_t length = 0, number_length = 0;
-    unsigned long number_start = 0;
-    const char hexdig_lowercase[] = "0123456789abcdef";
-    const char hexdig_uppercase[] = "0123456789ABCDEF";
+    const char *hexdig = ( mods->cap ) ? "0123456789ABCDEF"
+                                       : "0123456789abcdef";
     unsigned long long nval;
+    char digits[24]; /* enough for a 64-bit value in octal */
+    char *d = digits + sizeof(digits);
 
     /* check, we support octal/decimal/hex only */
     if ( (mods->base != 8) && (mods->base != 10) && (mods->base != 16) )
@@ -208,70 +205,84 @@ static size_t int2str(long long val, char *str, size_t strlen,
     else
         nval = (unsigned long long)(unsigned int)val;
 
-    /* convert */
-    number_start = length;
-    do {
-        /* overflow? */
-        if ( length >= strlen )
-            break;
+    /* convert, least significant digit first, from the end of digits[] */
+    if ( mods->base == 16 ) {
+        do {
+            *--d = hexdig[nval & 0xf];
+            nval >>= 4;
+        } while ( nval );
+    }
+    else if ( mods->base == 8 ) {
+        do {
+            *--d = '0' + (nval & 0x7);
+            nval >>= 3;
+        } while ( nval );
+    }
+    else {
+        uint32_t v, rem;
 
-        uint32_t rem = 0;
-        if ( !div64(nval, mods->base, &nval, &rem) )
-            return 0;
-        *(str + length) = ( mods->cap ) ?
-            hexdig_uppercase[rem] : hexdig_lowercase[rem];
-        length++;
-        number_length++;
-    } while ( nval );
+        while ( nval >> 32 ) {
+            if ( !div64(nval, 100, &nval, &rem) )
+                return 0;
+            *--d = dec_pairs[rem * 2 + 1];
+            *--d = dec_pairs[rem * 2];
+        }
+
+        v = (uint32_t)nval;
+        while ( v >= 100 ) {
+            rem = v % 100;
+            v /= 100;
+            *--d = dec_pairs[rem * 2 + 1];
+            *--d = dec_pairs[rem * 2];
+        }
+        if ( v >= 10 ) {
+            *--d = dec_pairs[v * 2 + 1];
+            *--d = dec_pairs[v * 2];
+        }
+        else
+            *--d = '0' + v;
+    }
+    number_length = digits + sizeof(digits) - d;
 
     /* handle precision */
-    while ( number_length < mods->precision ) {
+    for ( size_t i = number_length; i < mods->precision; i++ ) {
         /* overflow? */
         if ( length >= strlen )
-            break;
-
-        *(str + length) = '0';
-        length++;
-        number_length++;
+            return length;
+        *(str + length++) = '0';
     }
 
-    /* reverse */
-    for ( i = 0; i < number_length/2; i++ ) {
-        char ch;
-
-        ch = *(str + number_start + i);
-        *(str + number_start + i)
-            = *(str + number_start + (number_length - i - 1));
-        *(str + number_start + (number_length - i - 1)) = ch;
+    while ( d < digits + sizeof(digits) ) {
+        /* overflow? */
+        if ( length >= strlen )
+            break;
+        *(str + length++) = *d++;
     }
 
     return length;
 }
 
-int sl_vscnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+/*
+ * format fmt, sending each character to putc() as soon as it is produced;
+ * returns the number of characters sent
+ */
+int sl_vcbprintf(sl_putc_t putc, void *ctx, const char *fmt, va_list ap)
 {
-    unsigned int buf_pos = 0; /* return value doesn't count the last '\0' */
+    output_t out = { putc, ctx, 0 };
     const char *fmt_ptr;
     modifiers_t mods;
 
-    /* check buf */
-    if ( (buf == NULL) || (size == 0) )
-        return 0;
-
-    /* check fmt */
-    if ( fmt == NULL )
+    if ( putc == NULL || fmt == NULL )
         return 0;
 
-    sl_memset(&mods, 0, sizeof(mods));
-
-    while ( buf_pos < size ) {
+    while ( true ) {
         bool success;
 
         /* handle normal characters */
         while ( *fmt != '%' ) {
-                buf_pos = write_char_to_buffer(buf, size, buf_pos, *fmt);
             if ( *fmt == '\0' )
-                return buf_pos - 1;
+                return out.count;
+            write_char(&out, *fmt);
             fmt++;
         }
 
@@ -283,6 +294,7 @@ int sl_vscnprintf(char *buf, size_t size, const char *fmt, va_list ap)
          */
         fmt_ptr = fmt + 1; /* skip '%' */
         success = true;    /* assume parsing % substring would succeed */
+        sl_memset(&mods, 0, sizeof(mods));
 
         /* parsing flags */
         while ( true ) {
@@ -314,8 +326,10 @@ handle_width:
             mods.width = va_arg(ap, int);
             fmt_ptr++;
         }
-        else
-            mods.width = sl_strtoul(fmt_ptr, (char **)&fmt_ptr, 10);
+        else {
+            while ( isdigit(*fmt_ptr) )
+                mods.width = mods.width * 10 + (*fmt_ptr++ - '0');
+        }
 
         if ( *fmt_ptr == '.' ) {
             /* skip . */
@@ -326,8 +340,10 @@ handle_width:
                 mods.precision = va_arg(ap, int);
                 fmt_ptr++;
             }
-            else
-                mods.precision = sl_strtoul(fmt_ptr, (char **)&fmt_ptr, 10);
+            else {
+                while ( isdigit(*fmt_ptr) )
+                    mods.precision = mods.precision * 10 + (*fmt_ptr++ - '0');
+            }
         }
 
         /* parsing qualifier: h l L;
@@ -347,7 +363,7 @@ handle_width:
             fmt_ptr++;
         }
 
-#define write_number_to_buffer(__buf, __size, __buf_pos, __mods)           \
+#define write_number(__out, __mods)                                         \
 ({                                                                         \
     char __str[32];                                                        \
     size_t __real_strlen;                                                  \
@@ -367,8 +383,7 @@ handle_width:
         __real_strlen = int2str(__number, __str, sizeof(__str), &__mods);  \
     }                                                                      \
     __mods.digit = true;                                                   \
-    write_string_to_buffer(                                                \
-        __buf, __size, __buf_pos, __str, __real_strlen, &__mods);          \
+    write_string(__out, __str, __real_strlen, &__mods);                    \
 })
 
         /* parsing specifier */
@@ -381,8 +396,7 @@ handle_width:
 
                 str[0] = (char)va_arg(ap, int);
                 mods.digit = false;
-                buf_pos = write_string_to_buffer(
-                              buf, size, buf_pos, str, sl_strlen(str), &mods);
+                write_string(&out, str, sizeof(str), &mods);
                 break;
             }
         case 's':
@@ -391,19 +405,18 @@ handle_width:
 
                 str = va_arg(ap, char *);
                 mods.digit = false;
-                buf_pos = write_string_to_buffer(
-                              buf, size, buf_pos, str, sl_strlen(str), &mods);
+                write_string(&out, str, sl_strlen(str), &mods);
                 break;
             }
         case 'o':
             mods.base = 8;
-            buf_pos = write_number_to_buffer(buf, size, buf_pos, mods);
+            write_number(&out, mods);
             break;
 
         case 'X':
             mods.cap = true;
             mods.base = 16;
-            buf_pos = write_number_to_buffer(buf, size, buf_pos, mods);
+            write_number(&out, mods);
             break;
 
         case 'p':
@@ -412,24 +425,24 @@ handle_width:
         /* FALLTHROUGH */
         case 'x':
             mods.base = 16;
-            buf_pos = write_number_to_buffer(buf, size, buf_pos, mods);
+            write_number(&out, mods);
             break;
 
         case 'i':
         case 'd':
             mods.sign = true;
-            buf_pos = write_number_to_buffer(buf, size, buf_pos, mods);
+            write_number(&out, mods);
             break;
 
         case 'u':
-            buf_pos = write_number_to_buffer(buf, size, buf_pos, mods);
+            write_number(&out, mods);
             break;
         case 'e':
         case 'E':
             /* ignore */
             break;
         case '%':
-            buf_pos = write_char_to_buffer(buf, size, buf_pos, '%');
+            write_char(&out, '%');
             break;
         default:
             success = false;
@@ -442,12 +455,39 @@ handle_width:
         else {
             /* parsing % substring error, treat it as a normal string */
             /* *fmt = '%' */
-            buf_pos = write_char_to_buffer(buf, size, buf_pos, *fmt++);
+            write_char(&out, *fmt++);
         }
     } /* while */
+}
+
+/* sl_vcbprintf() sink that fills a buffer, leaving room for the '\0' */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+} buffer_sink_t;
+
+static void buffer_putc(char ch, void *ctx)
+{
+    buffer_sink_t *sink = ctx;
+
+    if ( sink->pos + 1 < sink->size )
+        sink->buf[sink->pos++] = ch;
+}
+
+int sl_vscnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+    buffer_sink_t sink = { buf, size, 0 };
+
+    /* check buf */
+    if ( (buf == NULL) || (size == 0) )
+        return 0;
+
+    sl_vcbprintf(buffer_putc, &sink, fmt, ap);
+    buf[sink.pos] = '\0';
 
-    buf[buf_pos - 1] = '\0'; /* if the buffer is overflowed. */
-    return buf_pos - 1;
+    /* return value doesn't count the last '\0' */
+    return sink.pos;
 }
 
 int sl_snprintf(char *buf, size_t size, const char *fmt, ...)
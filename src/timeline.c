@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <types.h>
+#include <stdbool.h>
+#include <slexec.h>
+#include <stdarg.h>
+#include <string.h>
+#include <printk.h>
+#include <processor.h>
+#include <misc.h>
+#include <timeline.h>
+
+static const char *g_phase_names[BOOT_PHASE_MAX] = {
+    [BOOT_PHASE_LOADER]     = "loader detection",
+    [BOOT_PHASE_CMDLINE]    = "cmdline parse",
+    [BOOT_PHASE_E820]       = "e820 copy",
+    [BOOT_PHASE_TPM_DETECT] = "TPM detect",
+    [BOOT_PHASE_SINIT]      = "SINIT discovery/copy",
+    [BOOT_PHASE_ACM_VERIFY] = "ACM verify",
+    [BOOT_PHASE_SKL]        = "SKL discovery/copy",
+    [BOOT_PHASE_TPM_INIT]   = "TPM init",
+    [BOOT_PHASE_KERNEL]     = "kernel expansion",
+    [BOOT_PHASE_PAGE_TABLE] = "page table build",
+    [BOOT_PHASE_TXT_HEAP]   = "TXT heap init",
+    [BOOT_PHASE_MTRRS]      = "MTRR setup",
+    [BOOT_PHASE_LAUNCH]     = "launch",
+};
+
+static slexec_timeline_t *g_timeline = NULL;
+
+/*
+ * the record's page may hold the loader's MBI until that has been moved out
+ * of the way, so the entry time is taken by the caller and passed in here
+ */
+void timeline_init(uint64_t entry)
+{
+    COMPILE_TIME_ASSERT(sizeof(slexec_timeline_t) <= SLEXEC_TIMELINE_SIZE);
+
+    g_timeline = (slexec_timeline_t *)SLEXEC_TIMELINE_ADDR;
+    sl_memset(g_timeline, 0, sizeof(*g_timeline));
+    g_timeline->uuid = (uuid_t)SLEXEC_TIMELINE_UUID;
+    g_timeline->nr_phases = BOOT_PHASE_MAX;
+    g_timeline->entry = entry;
+}
+
+void timeline_start(unsigned int phase)
+{
+    if ( g_timeline == NULL || phase >= BOOT_PHASE_MAX )
+        return;
+    g_timeline->phases[phase].start = rdtsc();
+}
+
+void timeline_end(unsigned int phase)
+{
+    if ( g_timeline == NULL || phase >= BOOT_PHASE_MAX )
+        return;
+    g_timeline->phases[phase].end = rdtsc();
+}
+
+/* fill in a phase that ran before the record could be written */
+void timeline_record(unsigned int phase, uint64_t start, uint64_t end)
+{
+    if ( g_timeline == NULL || phase >= BOOT_PHASE_MAX )
+        return;
+    g_timeline->phases[phase].start = start;
+    g_timeline->phases[phase].end = end;
+}
+
+void print_timeline(void)
+{
+    uint64_t accounted = 0, last = 0;
+
+    if ( g_timeline == NULL )
+        return;
+
+    g_timeline->ticks_per_millisec = get_tsc_ticks_per_millisec();
+
+    printk(SLEXEC_INFO"boot timeline (usecs):\n");
+    for ( unsigned int i = 0; i < BOOT_PHASE_MAX; i++ ) {
+        const boot_phase_time_t *p = &g_timeline->phases[i];
+
+        if ( p->start == 0 || p->end < p->start )
+            continue;
+        printk(SLEXEC_INFO"\t%-22s %10Lu (@ %Lu)\n", g_phase_names[i],
+               tsc_to_usecs(p->end - p->start),
+               tsc_to_usecs(p->start - g_timeline->entry));
+        accounted += p->end - p->start;
+        if ( p->end > last )
+            last = p->end;
+    }
+
+    if ( last == 0 )
+        return;
+    printk(SLEXEC_INFO"\t%-22s %10Lu\n", "other",
+           tsc_to_usecs(last - g_timeline->entry - accounted));
+    printk(SLEXEC_INFO"\t%-22s %10Lu\n", "total",
+           tsc_to_usecs(last - g_timeline->entry));
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TPM
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
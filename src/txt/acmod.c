@@ -34,6 +34,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TXT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -50,6 +52,7 @@
 #include <txt/acmod.h>
 #include <txt/mtrrs.h>
 #include <txt/heap.h>
+#include <platform.h>
 
 acm_hdr_t *g_sinit_module;
 uint32_t g_sinit_size;
@@ -529,34 +532,12 @@ bool is_sinit_acmod(const void *acmod_base, uint32_t acmod_size, bool quiet)
 
 bool does_acmod_match_platform(const acm_hdr_t* hdr)
 {
-    /* used to ensure we don't print chipset/proc info for each module */
-    static bool printed_host_info;
-
     /* this fn assumes that the ACM has already passed the is_acmod() checks */
-
-    /* get chipset fusing, device, and vendor id info */
-    txt_didvid_t didvid;
-    didvid._raw = read_pub_config_reg(TXTCR_DIDVID);
-    txt_ver_fsbif_qpiif_t ver;
-    ver._raw = read_pub_config_reg(TXTCR_VER_FSBIF);
-    if ( (ver._raw & 0xffffffff) == 0xffffffff ||
-         (ver._raw & 0xffffffff) == 0x00 )         /* need to use VER.QPIIF */
-        ver._raw = read_pub_config_reg(TXTCR_VER_QPIIF);
-    if ( !printed_host_info ) {
-        printk(SLEXEC_DETA"chipset production fused: %x\n", ver.prod_fused );
-        printk(SLEXEC_DETA"chipset ids: vendor: 0x%x, device: 0x%x, revision: 0x%x\n",
-               didvid.vendor_id, didvid.device_id, didvid.revision_id);
-    }
-
-    /* get processor family/model/stepping and platform ID */
-    uint64_t platform_id;
-    uint32_t fms = cpuid_eax(1);
-    platform_id = rdmsr(MSR_IA32_PLATFORM_ID);
-    if ( !printed_host_info ) {
-        printk(SLEXEC_DETA"processor family/model/stepping: 0x%x\n", fms );
-        printk(SLEXEC_DETA"platform id: 0x%Lx\n", (unsigned long long)platform_id);
-    }
-    printed_host_info = true;
+    const platform_info_t *platform = get_platform_info();
+    txt_didvid_t didvid = platform->didvid;
+    txt_ver_fsbif_qpiif_t ver = platform->ver;
+    uint32_t fms = platform->fms;
+    uint64_t platform_id = platform->platform_id;
 
     /*
      * check if chipset fusing is same
@@ -631,6 +612,28 @@ bool does_acmod_match_platform(const acm_hdr_t* hdr)
     return true;
 }
 
+/*
+ * rank two ACMs that both match the platform: the later build date wins,
+ * then the higher TXT SVN, then the higher ACM version
+ */
+bool is_acmod_newer(const acm_hdr_t *acm, const acm_hdr_t *than)
+{
+    acm_info_table_t *acm_info, *than_info;
+
+    if ( than == NULL )
+        return true;
+    if ( acm->date != than->date )
+        return acm->date > than->date;
+    if ( acm->txt_svn != than->txt_svn )
+        return acm->txt_svn > than->txt_svn;
+
+    acm_info = get_acmod_info_table(acm);
+    than_info = get_acmod_info_table(than);
+    if ( acm_info == NULL || than_info == NULL )
+        return false;
+    return acm_info->acm_ver > than_info->acm_ver;
+}
+
 static acm_hdr_t *get_bios_sinit(const void *sinit_region_base)
 {
     if ( sinit_region_base == NULL )
@@ -656,8 +659,8 @@ acm_hdr_t *copy_sinit(const acm_hdr_t *sinit)
 {
     /* get BIOS-reserved region from TXT.SINIT.BASE config reg */
     void *sinit_region_base =
-        (void*)(unsigned long)read_pub_config_reg(TXTCR_SINIT_BASE);
-    uint32_t sinit_region_size = (uint32_t)read_pub_config_reg(TXTCR_SINIT_SIZE);
+        (void*)(unsigned long)get_platform_info()->sinit_base;
+    uint32_t sinit_region_size = (uint32_t)get_platform_info()->sinit_size;
     printk(SLEXEC_DETA"TXT.SINIT.BASE: %p\n", sinit_region_base);
     printk(SLEXEC_DETA"TXT.SINIT.SIZE: 0x%x (%u)\n", sinit_region_size, sinit_region_size);
 
@@ -669,12 +672,14 @@ acm_hdr_t *copy_sinit(const acm_hdr_t *sinit)
         /* no other SINIT was provided so must use one BIOS provided */
         if ( sinit == NULL ) {
             printk(SLEXEC_WARN"no SINIT provided by bootloader; using BIOS SINIT\n");
+            g_sinit_size = bios_sinit->size*4;
             return bios_sinit;
         }
 
         /* is it newer than the one we've been provided? */
-        if ( bios_sinit->date >= sinit->date ) {
+        if ( !is_acmod_newer(sinit, bios_sinit) ) {
             printk(SLEXEC_INFO"BIOS-provided SINIT is newer, so using it\n");
+            g_sinit_size = bios_sinit->size*4;
             return bios_sinit;    /* yes */
         }
         else
@@ -702,6 +707,14 @@ acm_hdr_t *copy_sinit(const acm_hdr_t *sinit)
     if ( sinit_region_base == NULL )
        return NULL;
 
+    /* a warm reboot or the BIOS may have left this very image there */
+    g_sinit_size = sinit->size*4;
+    if ( sl_memcmp(sinit_region_base, sinit, sinit->size*4) == 0 ) {
+        printk(SLEXEC_DETA"SINIT (size=%x) already at %p, not copying\n",
+               sinit->size*4, sinit_region_base);
+        return (acm_hdr_t *)sinit_region_base;
+    }
+
     /* copy it there */
     sl_memcpy(sinit_region_base, sinit, sinit->size*4);
 
@@ -720,25 +733,26 @@ void verify_ia32_sgx_svn_status(const acm_hdr_t *acm_hdr)
 {
     struct tpm_if *tpm = get_tpm();
     const struct tpm_if_fp *tpm_fp = get_tpm_fp();
+    const platform_info_t *platform = get_platform_info();
 
     printk(SLEXEC_INFO"SGX:verify_IA32_se_svn_status is called\n");
 
     /* check if SGX is enabled by cpuid with ax=7, cx=0 */
-    if ((cpuid_ebx1(CPUID_X86_EXT_FEATURE_LEAF, 0) & CPUID_X86_FEATURE_SGX) == 0) {
-        printk(SLEXEC_ERR"SGX is not enabled, cpuid.ebx: 0x%x\n", cpuid_ebx1(7,0));
+    if ((platform->ext_feat_ebx & CPUID_X86_FEATURE_SGX) == 0) {
+        printk(SLEXEC_ERR"SGX is not enabled, cpuid.ebx: 0x%x\n", platform->ext_feat_ebx);
         return;
     }
-    printk(SLEXEC_INFO"SGX is enabled, cpuid.ebx:0x%x\n", cpuid_ebx1(7,0));
+    printk(SLEXEC_INFO"SGX is enabled, cpuid.ebx:0x%x\n", platform->ext_feat_ebx);
     printk(SLEXEC_INFO"Comparing se_svn with ACM Header se_svn\n");
 
-    if ((rdmsr(MSR_IA32_SGX_SVN_STATUS) & SGX_SVN_STATUS_SINIT) != acm_hdr->se_svn) {
+    if ((platform->sgx_svn_status & SGX_SVN_STATUS_SINIT) != acm_hdr->se_svn) {
         printk(SLEXEC_INFO"se_svn is not equal to ACM se_svn\n");
         if (!tpm_fp->nv_write(tpm, 0, tpm->sgx_svn_index, 0, (uint8_t *)&(acm_hdr->se_svn), 1))
             printk(SLEXEC_ERR"Write sgx_svn_index 0x%x failed. \n", tpm->sgx_svn_index);
         else
             printk(SLEXEC_INFO"Write sgx_svn_index with 0x%x successful.\n", acm_hdr->se_svn);
 
-        if ((rdmsr(MSR_IA32_SGX_SVN_STATUS) & SGX_SVN_STATUS_LOCK) != 0) {
+        if ((platform->sgx_svn_status & SGX_SVN_STATUS_LOCK) != 0) {
            /* reset platform */
            printk(SLEXEC_WARN"SGX:A reset is required in this boot, resetting\n");
            outb(0xcf9, 0x06);
@@ -751,7 +765,7 @@ void verify_ia32_sgx_svn_status(const acm_hdr_t *acm_hdr)
 
 bool verify_acmod(const acm_hdr_t *acm_hdr)
 {
-    getsec_parameters_t params;
+    const getsec_parameters_t *params = &get_platform_info()->getsec_params;
     uint32_t size;
 
     /* assumes this already passed is_acmod() test */
@@ -779,14 +793,9 @@ bool verify_acmod(const acm_hdr_t *acm_hdr)
         return false;
     }
 
-    if ( !smx_get_parameters(&params) ) {
-        printk(SLEXEC_ERR"smx_get_parameters() failed\n");
-        return false;
-    }
-
-    if ( size > params.acm_max_size ) {
+    if ( size > params->acm_max_size ) {
         printk(SLEXEC_ERR"AC mod size too large: %x (max=%x)\n", size,
-               params.acm_max_size);
+               params->acm_max_size);
         return false;
     }
 
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TXT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -49,6 +51,8 @@
 #include <txt/acmod.h>
 #include <txt/mtrrs.h>
 #include <txt/heap.h>
+#include <txt/smx.h>
+#include <platform.h>
 
 /*
  * extended data elements
@@ -474,7 +478,7 @@ static bool verify_evt_log(const event_log_container_t *elog)
         return false;
     }
 
-    if ( elog->size != MAX_EVENT_LOG_SIZE ) {
+    if ( elog->size < sizeof(*elog) ) {
         printk(SLEXEC_ERR"Bad event log container size: 0x%x\n", elog->size);
         return false;
     }
@@ -566,8 +570,8 @@ static bool verify_ext_data_elts(const heap_ext_data_element_t elts[],
 
 bool verify_bios_data(const txt_heap_t *txt_heap)
 {
-    uint64_t heap_base = read_pub_config_reg(TXTCR_HEAP_BASE);
-    uint64_t heap_size = read_pub_config_reg(TXTCR_HEAP_SIZE);
+    uint64_t heap_base = get_platform_info()->heap_base;
+    uint64_t heap_size = get_platform_info()->heap_size;
     printk(SLEXEC_DETA"TXT.HEAP.BASE: 0x%jx\n", heap_base);
     printk(SLEXEC_DETA"TXT.HEAP.SIZE: 0x%jx (%ju)\n", heap_size, heap_size);
 
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TXT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -68,185 +70,206 @@ static void print_mtrrs(const mtrr_state_t *saved_state)
 }
 
 /*
- * set the memory type for specified range (base to base+size)
- * to mem_type and everything else to UC
+ * plan the MTRRs that make base to base+size mem_type and everything else
+ * UC, without touching any MSR; the range is covered exactly with the
+ * fewest naturally aligned power-of-2 blocks, taking at each step the
+ * largest block that both the current base alignment and the remaining
+ * size allow
  */
-static bool set_mem_type(const void *base, uint32_t size,
-                          uint32_t mem_type)
+static bool plan_mem_type(uint32_t base, uint32_t size, uint32_t mem_type,
+                          mtrr_state_t *plan)
 {
-    int num_pages;
-    int ndx;
-    mtrr_def_type_t mtrr_def_type;
     mtrr_cap_t mtrr_cap;
-    mtrr_physmask_t mtrr_physmask;
-    mtrr_physbase_t mtrr_physbase;
-    unsigned long base_v;
-    int i =0;
-    int mtrr_s = 1; /* mtrr size in pages */
+    uint32_t num_pages, base_page, block;
+    unsigned int ndx;
 
-    /*
-     * disable all fixed MTRRs
-     * set default type to UC
-     */
-    mtrr_def_type.raw = rdmsr(MSR_MTRRdefType);
-    mtrr_def_type.fe = 0;
-    mtrr_def_type.type = MTRR_TYPE_UNCACHABLE;
-    wrmsr(MSR_MTRRdefType, mtrr_def_type.raw);
+    sl_memset(plan, 0, sizeof(*plan));
+
+    /* all fixed MTRRs disabled, default type UC, MTRRs off until written */
+    plan->mtrr_def_type.raw = rdmsr(MSR_MTRRdefType);
+    plan->mtrr_def_type.fe = 0;
+    plan->mtrr_def_type.e = 0;
+    plan->mtrr_def_type.type = MTRR_TYPE_UNCACHABLE;
 
-    /*
-     * initially disable all variable MTRRs (we'll enable the ones we use)
-     */
     mtrr_cap.raw = rdmsr(MSR_MTRRcap);
-    for ( ndx = 0; ndx < mtrr_cap.vcnt; ndx++ ) {
-        mtrr_physmask.raw = rdmsr(MTRR_PHYS_MASK0_MSR + ndx*2);
-        mtrr_physmask.v = 0;
-        wrmsr(MTRR_PHYS_MASK0_MSR + ndx*2, mtrr_physmask.raw);
-    }
+    plan->num_var_mtrrs = (mtrr_cap.vcnt > MAX_VARIABLE_MTRRS) ?
+                          MAX_VARIABLE_MTRRS : mtrr_cap.vcnt;
 
-    /*
-     * map all AC module pages as mem_type
-     */
+    if ( base & ~PAGE_MASK ) {
+        printk(SLEXEC_ERR"MTRR range base %x is not page aligned\n", base);
+        return false;
+    }
 
     num_pages = PAGE_UP(size) >> PAGE_SHIFT;
+    base_page = base >> PAGE_SHIFT;
     ndx = 0;
 
-    printk(SLEXEC_DETA"setting MTRRs for acmod: base=%p, size=%x, num_pages=%d\n",
-           base, size, num_pages);
-    /*
-     * Each VAR MTRR base must be a multiple if that MTRR's Size
-    */
-    base_v = (unsigned long) base;
-    while ((base_v & 0x01) == 0) {
-          i++;
-          base_v = base_v >>1 ;
-
-    }
-
-    for (int j = i - 12; j > 0; j--)
-        mtrr_s = mtrr_s*2; //mtrr_s = mtrr_s << 1
-
-    printk(SLEXEC_DETA"The maximum allowed MTRR range size=%d Pages \n", mtrr_s);
-
-    while (num_pages >= mtrr_s) {
-	/* set the base of the current MTRR */
-        mtrr_physbase.raw = rdmsr(MTRR_PHYS_BASE0_MSR + ndx*2);
-        mtrr_physbase.base = ((unsigned long)base >> PAGE_SHIFT) &
-	                     SINIT_MTRR_MASK;
-        mtrr_physbase.type = mem_type;
-        wrmsr(MTRR_PHYS_BASE0_MSR + ndx*2, mtrr_physbase.raw);
-
-        mtrr_physmask.raw = rdmsr(MTRR_PHYS_MASK0_MSR + ndx*2);
-        mtrr_physmask.mask = ~(mtrr_s - 1) & SINIT_MTRR_MASK;
-        mtrr_physmask.v = 1;
-        wrmsr(MTRR_PHYS_MASK0_MSR + ndx*2, mtrr_physmask.raw);
+    while ( num_pages > 0 ) {
+        block = 1 << (fls(num_pages) - 1);
+        if ( base_page != 0 && (base_page & -base_page) < block )
+            block = base_page & -base_page;
 
-        base += (mtrr_s * PAGE_SIZE);
-        num_pages -= mtrr_s;
-        ndx++;
-        if ( ndx == mtrr_cap.vcnt ) {
+        if ( ndx == plan->num_var_mtrrs ) {
             printk(SLEXEC_ERR"exceeded number of var MTRRs when mapping range\n");
             return false;
         }
-    }
 
-    while ( num_pages > 0 ) {
-        uint32_t pages_in_range;
-
-        /* set the base of the current MTRR */
-        mtrr_physbase.raw = rdmsr(MTRR_PHYS_BASE0_MSR + ndx*2);
-        mtrr_physbase.base = ((unsigned long)base >> PAGE_SHIFT) &
-	                     SINIT_MTRR_MASK;
-        mtrr_physbase.type = mem_type;
-        wrmsr(MTRR_PHYS_BASE0_MSR + ndx*2, mtrr_physbase.raw);
-
-        /*
-         * calculate MTRR mask
-         * MTRRs can map pages in power of 2
-         * may need to use multiple MTRRS to map all of region
-         */
-        pages_in_range = 1 << (fls(num_pages) - 1);
-
-        mtrr_physmask.raw = rdmsr(MTRR_PHYS_MASK0_MSR + ndx*2);
-        mtrr_physmask.mask = ~(pages_in_range - 1) & SINIT_MTRR_MASK;
-        mtrr_physmask.v = 1;
-        wrmsr(MTRR_PHYS_MASK0_MSR + ndx*2, mtrr_physmask.raw);
-
-        /*prepare for the next loop depending on number of pages
-         * We figure out from the above how many pages could be used in this
-         * mtrr. Then we decrement the count, increment the base,
-         * increment the mtrr we are dealing with, and if num_pages is
-         * still not zero, we do it again.
-         */
-        base += (pages_in_range * PAGE_SIZE);
-        num_pages -= pages_in_range;
+        plan->mtrr_var_pair[ndx].mtrr_physbase.base = base_page & SINIT_MTRR_MASK;
+        plan->mtrr_var_pair[ndx].mtrr_physbase.type = mem_type;
+        plan->mtrr_var_pair[ndx].mtrr_physmask.mask = ~(block - 1) & SINIT_MTRR_MASK;
+        plan->mtrr_var_pair[ndx].mtrr_physmask.v = 1;
+
+        base_page += block;
+        num_pages -= block;
         ndx++;
-        if ( ndx == mtrr_cap.vcnt ) {
-            printk(SLEXEC_ERR"exceeded number of var MTRRs when mapping range\n");
-            return false;
-        }
     }
+
     return true;
 }
 
+/* program a complete MTRR set, MTRRs have to be disabled */
+static void write_mtrrs(const mtrr_state_t *plan)
+{
+    mtrr_cap_t mtrr_cap;
+    unsigned int ndx;
+
+    wrmsr(MSR_MTRRdefType, plan->mtrr_def_type.raw);
+
+    for ( ndx = 0; ndx < plan->num_var_mtrrs; ndx++ ) {
+        wrmsr(MTRR_PHYS_BASE0_MSR + ndx*2,
+              plan->mtrr_var_pair[ndx].mtrr_physbase.raw);
+        wrmsr(MTRR_PHYS_MASK0_MSR + ndx*2,
+              plan->mtrr_var_pair[ndx].mtrr_physmask.raw);
+    }
+
+    /* any MTRRs beyond what we track just get turned off */
+    mtrr_cap.raw = rdmsr(MSR_MTRRcap);
+    for ( ; ndx < mtrr_cap.vcnt; ndx++ )
+        wrmsr(MTRR_PHYS_MASK0_MSR + ndx*2, 0);
+}
+
 /*
  * this must be done for each processor so that all have the same
  * memory types
+ *
+ * This follows the SDM MTRR update sequence ("MTRR Considerations in MP
+ * Systems", Vol. 3A). With CR0.CD=1 the caches take no new lines, so the
+ * WBINVD on the way in already leaves nothing cached; the second flush
+ * the SDM lists after the update is only needed for the TLBs, which
+ * reloading CR3 and restoring CR4.PGE take care of.
  */
 bool set_mtrrs_for_acmod(const acm_hdr_t *hdr)
 {
+    static mtrr_state_t plan;
     unsigned long eflags;
     unsigned long cr0, cr4;
+    uint64_t start, flushed, end;
 
     /*
-     * need to do some things before we start changing MTRRs
-     *
-     * since this will modify some of the MTRRs, they should be saved first
-     * so that they can be restored once the AC mod is done
+     * work out the complete MTRR set before touching anything, so that a
+     * failure leaves the caches and MTRRs the way they were
      */
+    printk(SLEXEC_DETA"setting MTRRs for acmod: base=%p, size=%x\n",
+           hdr, hdr->size*4);
+    if ( !plan_mem_type((uint32_t)hdr, hdr->size*4, MTRR_TYPE_WRBACK, &plan) )
+        return false;
+    print_mtrrs(&plan);
 
     /* disable interrupts */
     eflags = read_eflags();
     disable_intr();
 
+    start = rdtsc();
+
     /* save CR0 then disable cache (CRO.CD=1, CR0.NW=0) */
     cr0 = read_cr0();
     write_cr0((cr0 & ~CR0_NW) | CR0_CD);
 
     /* flush caches */
     wbinvd();
+    flushed = rdtsc();
 
     /* save CR4 and disable global pages (CR4.PGE=0) */
     cr4 = read_cr4();
     write_cr4(cr4 & ~CR4_PGE);
 
-    /* disable MTRRs */
+    /* disable MTRRs, write the new set in one go and enable them again */
     set_all_mtrrs(false);
-
-    /*
-     * now set MTRRs for AC mod and rest of memory
-     */
-    if ( !set_mem_type(hdr, hdr->size*4, MTRR_TYPE_WRBACK) )
-        return false;
-
-    /*
-     * now undo some of earlier changes and enable our new settings
-     */
-
-    /* flush caches */
-    wbinvd();
-
-    /* enable MTRRs */
+    write_mtrrs(&plan);
     set_all_mtrrs(true);
 
+    /* flush TLBs */
+    write_cr3(read_cr3());
+
     /* restore CR0 (cacheing) */
     write_cr0(cr0);
 
     /* restore CR4 (global pages) */
     write_cr4(cr4);
 
+    end = rdtsc();
+
     /* enable interrupts */
     write_eflags(eflags);
 
+    printk(SLEXEC_DETA"MTRR update took %Lu us (WBINVD %Lu us)\n",
+           tsc_to_usecs(end - start), tsc_to_usecs(flushed - start));
+
+    return true;
+}
+
+/*
+ * check that every page of the AC module is WB under the MTRRs as they are
+ * programmed right now, SENTER resets the platform if any is not
+ */
+bool verify_mtrrs_for_acmod(const acm_hdr_t *hdr)
+{
+    static mtrr_state_t state;
+    uint32_t page, last_page, base, mask;
+    unsigned int ndx;
+    bool matched;
+
+    state.mtrr_def_type.raw = rdmsr(MSR_MTRRdefType);
+    if ( !state.mtrr_def_type.e ) {
+        printk(SLEXEC_ERR"MTRRs are disabled\n");
+        return false;
+    }
+    state.num_var_mtrrs = ((mtrr_cap_t)rdmsr(MSR_MTRRcap)).vcnt;
+    if ( state.num_var_mtrrs > MAX_VARIABLE_MTRRS )
+        state.num_var_mtrrs = MAX_VARIABLE_MTRRS;
+    for ( ndx = 0; ndx < state.num_var_mtrrs; ndx++ ) {
+        state.mtrr_var_pair[ndx].mtrr_physbase.raw =
+            rdmsr(MTRR_PHYS_BASE0_MSR + ndx*2);
+        state.mtrr_var_pair[ndx].mtrr_physmask.raw =
+            rdmsr(MTRR_PHYS_MASK0_MSR + ndx*2);
+    }
+
+    page = (uint32_t)hdr >> PAGE_SHIFT;
+    last_page = ((uint32_t)hdr + hdr->size*4 - 1) >> PAGE_SHIFT;
+    for ( ; page <= last_page; page++ ) {
+        matched = false;
+        for ( ndx = 0; ndx < state.num_var_mtrrs; ndx++ ) {
+            if ( !state.mtrr_var_pair[ndx].mtrr_physmask.v )
+                continue;
+            base = state.mtrr_var_pair[ndx].mtrr_physbase.base & SINIT_MTRR_MASK;
+            mask = state.mtrr_var_pair[ndx].mtrr_physmask.mask & SINIT_MTRR_MASK;
+            if ( (page & mask) != (base & mask) )
+                continue;
+            if ( state.mtrr_var_pair[ndx].mtrr_physbase.type != MTRR_TYPE_WRBACK ) {
+                printk(SLEXEC_ERR"ACM page 0x%x is type %x in MTRR %u\n",
+                       page << PAGE_SHIFT,
+                       (uint32_t)state.mtrr_var_pair[ndx].mtrr_physbase.type, ndx);
+                return false;
+            }
+            matched = true;
+        }
+        if ( !matched && state.mtrr_def_type.type != MTRR_TYPE_WRBACK ) {
+            printk(SLEXEC_ERR"ACM page 0x%x is not covered by a WB MTRR\n",
+                   page << PAGE_SHIFT);
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -261,7 +284,7 @@ void save_mtrrs(mtrr_state_t *saved_state)
     mtrr_cap.raw = rdmsr(MSR_MTRRcap);
     if ( mtrr_cap.vcnt > MAX_VARIABLE_MTRRS ) {
         /* print warning but continue saving what we can */
-        /* (set_mem_type() won't exceed the array, so we're safe doing this) */
+        /* (plan_mem_type() won't exceed the array, so we're safe doing this) */
         printk(SLEXEC_WARN"actual # var MTRRs (%d) > MAX_VARIABLE_MTRRS (%d)\n",
                mtrr_cap.vcnt, MAX_VARIABLE_MTRRS);
         saved_state->num_var_mtrrs = MAX_VARIABLE_MTRRS;
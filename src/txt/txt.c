@@ -34,6 +34,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TXT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -49,6 +51,7 @@
 #include <tpm.h>
 #include <slr_table.h>
 #include <cmdline.h>
+#include <timeline.h>
 #include <txt/smx.h>
 #include <txt/mle.h>
 #include <txt/txt.h>
@@ -66,6 +69,7 @@ static heap_event_log_ptr_elt2_1_t *g_elog_2_1 = NULL;
 static uint32_t g_using_da = 0;
 
 /* Area to collect and build SLR Table information */
+#define SLR_POLICY_ENTRIES 7
 static uint8_t slr_policy_buf[256] = {0};
 static struct slr_entry_dl_info g_slr_entry_dl_info = {0};
 static struct slr_entry_log_info g_slr_entry_log_info = {0};
@@ -86,160 +90,222 @@ static void dump_page_tables(void *ptab_base)
 {
     uint64_t *pg_dir_ptr_tab;
     uint64_t *pte, *pde;
-    int i, j;
+    int i, j, k;
 
     pg_dir_ptr_tab = (uint64_t*)ptab_base;
-    printk(SLEXEC_DETA"PDPE(0)=0x%llx\n", pg_dir_ptr_tab[0] & PAGE_MASK);
-
-    pde = (uint64_t*)(uint32_t)(pg_dir_ptr_tab[0] & PAGE_MASK);
 
-    for (i = 0; i < 512; i++) {
-        if (pde[i] == 0)
+    for (k = 0; k < 4; k++) {
+        if (pg_dir_ptr_tab[k] == 0)
             break;
 
-        printk(SLEXEC_DETA"  PDE(%d)=0x%llx\n", i, pde[i]);
-        pte = (uint64_t*)(uint32_t)(pde[i] & PAGE_MASK);
+        printk(SLEXEC_DETA"PDPE(%d)=0x%llx\n", k, pg_dir_ptr_tab[k] & PAGE_MASK);
+        pde = (uint64_t*)(uint32_t)(pg_dir_ptr_tab[k] & PAGE_MASK);
 
-        for (j = 0; j < 512; j++) {
-            if (pte[j] == 0)
+        for (i = 0; i < 512; i++) {
+            if (pde[i] == 0)
                 break;
 
-            printk(SLEXEC_DETA"    PTE(%d)=0x%llx\n", j, pte[j]);
+            printk(SLEXEC_DETA"  PDE(%d)=0x%llx\n", i, pde[i]);
+            pte = (uint64_t*)(uint32_t)(pde[i] & PAGE_MASK);
+
+            for (j = 0; j < 512; j++) {
+                if (pte[j] == 0)
+                    break;
+
+                printk(SLEXEC_DETA"    PTE(%d)=0x%llx\n", j, pte[j]);
+            }
         }
     }
 }
 #endif
 
 /*
- * build_mle_pagetable()
+ * MLE page tables: one PDPT, then the PDs, then the PTs, each level in a
+ * single run of pages in ascending order (which is how SINIT wants them)
+ * and all of it below the MLE. A PDPT entry covers 1G, so up to four PDs
+ * map the MLE from linear address 0 for any MLE that fits below 4G.
  */
-static void *calculate_ptab_base_size(uint32_t *ptab_size)
-{
-    uint32_t pages;
-    void *ptab_base;
+#define PTES_PER_PAGE   (PAGE_SIZE / sizeof(uint64_t))
 
-    /*
-     * TODO should check there is enough space between kernel base and the
-     * beginning of the RAM region where it is located.
-     */
-
-    /* Round up pages from int divide and add PD and PDPT */
-    pages = g_sl_kernel_setup.protected_mode_size/(512*PAGE_SIZE) + 3;
-    *ptab_size = pages*PAGE_SIZE;
-    ptab_base = (void*)(PAGE_DOWN(g_sl_kernel_setup.protected_mode_base) - *ptab_size);
-
-    printk(SLEXEC_DETA"Page table start=0x%x, size=0x%x, count=0x%x\n",
-           (uint32_t)ptab_base, *ptab_size, pages);
+static uint32_t mle_ptab_pages(uint32_t mle_pages, uint32_t *nr_pds,
+                               uint32_t *nr_pts)
+{
+    *nr_pts = (mle_pages + PTES_PER_PAGE - 1) / PTES_PER_PAGE;
+    *nr_pds = (*nr_pts + PTES_PER_PAGE - 1) / PTES_PER_PAGE;
 
-    return ptab_base;
+    return 1 + *nr_pds + *nr_pts;
 }
 
 /*
- * If enough room is available in front of the MLE, the maximum size of an
- * MLE that can be covered is 1G. This is due to having 512 PDEs pointing
- * to 512 page tables with 512 PTEs each.
+ * Put the tables in free RAM right below the MLE, falling back to the
+ * slexec low memory block for kernels loaded too low for that (i.e. ones
+ * that are not relocatable and so sit at 1M)
  */
-#define SLEXEC_MAX_MLE_SIZE (512*512*4096)
+static void *alloc_mle_ptab(uint32_t mle_start, uint32_t ptab_size)
+{
+    uint64_t base;
 
-/* Page dir/table entry is phys addr + P + R/W + PWT */
-#define MAKE_PDTE(addr)  (((uint64_t)(unsigned long)(addr) & PAGE_MASK) | 0x01)
+    /* only SINIT walks these, so the kernel can have them back */
+    base = e820_alloc(ptab_size, PAGE_SIZE, mle_start, E820_ALLOC_TOP_DOWN,
+                      E820_RAM);
+    if ( base != 0 )
+        return (void *)(uint32_t)base;
 
-/* The MLE page tables have to be below the MLE which by default loads at 1M */
-/* so 20 pages are carved out of low memory from 0x6B000 to 0x80000 */
-/* That leave 18 page table pages that can cover up to 36M */
-/* can only contain 4k pages */
+    if ( ptab_size <= SLEXEC_MLEPT_SIZE &&
+         SLEXEC_MLEPT_ADDR + SLEXEC_MLEPT_SIZE <= mle_start )
+        return (void *)SLEXEC_MLEPT_ADDR;
+
+    return NULL;
+}
 
 static void *build_mle_pagetable(void)
 {
-    void *ptab_base;
-    uint32_t ptab_size, mle_off, pd_off;
-    void *pg_dir_ptr_tab, *pg_dir, *pg_tab;
-    uint64_t *pte, *pde;
+    uint64_t *pdpt, *pd, *pt;
     uint32_t mle_start = g_sl_kernel_setup.protected_mode_base;
     uint32_t mle_size = g_sl_kernel_setup.protected_mode_size;
+    uint32_t mle_pages, nr_pds, nr_pts, ptab_size, i;
 
     printk(SLEXEC_DETA"MLE start=0x%x, end=0x%x, size=0x%x\n",
            mle_start, mle_start+mle_size, mle_size);
 
-    if ( mle_size > SLEXEC_MAX_MLE_SIZE ) {
-        printk(SLEXEC_ERR"MLE size exceeds maximum size allowable (1Gb)\n");
-        return NULL;
-    }
-
     /* should start on page boundary */
     if ( mle_start & ~PAGE_MASK ) {
         printk(SLEXEC_ERR"MLE start is not page-aligned\n");
         return NULL;
     }
 
-    /*
-     * Place ptab_base below MLE. If the kernel is not relocatable then
-     * we have to use the low memory block since the kernel gets loaded
-     * at 1M. This does not work on server systems though.
-     */
-    if ( g_sl_kernel_setup.boot_params->hdr.relocatable_kernel ) {
-        ptab_base = calculate_ptab_base_size(&ptab_size);
-        if ( !ptab_base ) {
-            printk(SLEXEC_ERR"MLE size exceeds space available for page tables\n");
-            return NULL;
-        }
+    mle_pages = PAGE_UP(mle_size) >> PAGE_SHIFT;
+    if ( mle_pages == 0 ) {
+        printk(SLEXEC_ERR"MLE is empty\n");
+        return NULL;
     }
-    else {
-        if ( mle_size > SLEXEC_MLEPT_BYTES_COVERED ) {
-            printk(SLEXEC_ERR"MLE size exceeds size allowable in low mem\n");
-            return NULL;
-        }
-        ptab_size = SLEXEC_MLEPT_SIZE;
-        ptab_base = (void*)SLEXEC_MLEPT_ADDR;
+    ptab_size = mle_ptab_pages(mle_pages, &nr_pds, &nr_pts) * PAGE_SIZE;
+
+    pdpt = alloc_mle_ptab(mle_start, ptab_size);
+    if ( pdpt == NULL ) {
+        printk(SLEXEC_ERR"no room below the MLE for 0x%x bytes of page tables\n",
+               ptab_size);
+        return NULL;
     }
+    pd = pdpt + PTES_PER_PAGE;
+    pt = pd + nr_pds * PTES_PER_PAGE;
+
+    printk(SLEXEC_DETA"ptab_size=%x, ptab_base=%p, PDs=%u, PTs=%u\n",
+           ptab_size, pdpt, nr_pds, nr_pts);
 
-    sl_memset(ptab_base, 0, ptab_size);
-    printk(SLEXEC_DETA"ptab_size=%x, ptab_base=%p\n", ptab_size, ptab_base);
+    /* every level is written front to back, only the tails get cleared */
+    for ( i = 0; i < nr_pds; i++ )
+        pdpt[i] = MAKE_PDTE(pd + i * PTES_PER_PAGE);
+    sl_memset(pdpt + nr_pds, 0, (PTES_PER_PAGE - nr_pds) * sizeof(uint64_t));
 
-    pg_dir_ptr_tab = ptab_base;
-    pg_dir         = pg_dir_ptr_tab + PAGE_SIZE;
-    pg_tab         = pg_dir + PAGE_SIZE;
+    for ( i = 0; i < nr_pts; i++ )
+        pd[i] = MAKE_PDTE(pt + i * PTES_PER_PAGE);
+    sl_memset(pd + nr_pts, 0,
+              (nr_pds * PTES_PER_PAGE - nr_pts) * sizeof(uint64_t));
 
-    /* only use first entry in page dir ptr table */
-    *(uint64_t *)pg_dir_ptr_tab = MAKE_PDTE(pg_dir);
+    for ( i = 0; i < mle_pages; i++ )
+        pt[i] = MAKE_PDTE(mle_start + i * PAGE_SIZE);
+    sl_memset(pt + mle_pages, 0,
+              (nr_pts * PTES_PER_PAGE - mle_pages) * sizeof(uint64_t));
 
-    /* start with first entry in page dir */
-    *(uint64_t *)pg_dir = MAKE_PDTE(pg_tab);
+#if 0
+    dump_page_tables(pdpt);
+#endif
 
-    pte = pg_tab;
-    pde = pg_dir;
-    mle_off = 0;
-    pd_off = 0;
+    return pdpt;
+}
 
-    do {
-        *pte = MAKE_PDTE(mle_start + mle_off);
+/*
+ * The DRTM event log lives in its own reserved RAM rather than the TXT heap
+ * and is sized for what will go in it: the events SINIT logs, one per SLR
+ * policy entry the DLME measures and the evtlog_events headroom, each with
+ * a digest for every active PCR bank.
+ */
+#define SINIT_LOG_EVENTS     32
+#define EVTLOG_EVENT_DATA    64     /* average event data, bytes */
+#define EVTLOG_HDR_SIZE      0x200  /* container or TCG Spec ID event */
+#define MAX_EVTLOG_EVENTS    4096   /* cap on the evtlog_events headroom */
 
-        pte++;
-        mle_off += PAGE_SIZE;
+static void *g_evtlog_base;
+static uint32_t g_evtlog_size;
 
-        pd_off++;
-        if ( !(pd_off % 512) ) {
-            /* break if we don't need any additional page entries */
-            if (mle_off >= mle_size)
-                break;
-            pde++;
-            *pde = MAKE_PDTE(pte);
+static uint32_t calc_event_log_size(void)
+{
+    struct tpm_if *tpm = get_tpm();
+    uint32_t nr_events, event_size;
+    uint64_t size;
+
+    nr_events = get_slexec_evtlog_events();
+    if ( nr_events > MAX_EVTLOG_EVENTS ) {
+        printk(SLEXEC_WARN"evtlog_events %u too large, using %u\n",
+               nr_events, MAX_EVTLOG_EVENTS);
+        nr_events = MAX_EVTLOG_EVENTS;
+    }
+    nr_events += SINIT_LOG_EVENTS + SLR_POLICY_ENTRIES;
+
+    if ( get_evtlog_type() == EVTLOG_TPM2_TCG ) {
+        /* PCR index, event type, digest count and event size */
+        event_size = 4*sizeof(uint32_t) + EVTLOG_EVENT_DATA;
+        for ( unsigned int i = 0; i < tpm->banks; i++ ) {
+            unsigned int digest_size = get_hash_size(tpm->algs_banks[i]);
+
+            event_size += sizeof(uint16_t) +
+                          (digest_size ? digest_size : SHA512_LENGTH);
         }
-    } while ( mle_off < mle_size );
+    }
+    else
+        event_size = sizeof(tpm12_pcr_event_t) + EVTLOG_EVENT_DATA;
 
-#if 0
-    dump_page_tables(ptab_base);
-#endif
+    size = EVTLOG_HDR_SIZE + (uint64_t)nr_events * event_size;
+    return PAGE_UP(size);
+}
+
+/* VT-d PMR windows, fixed before the kernel gets its e820 map */
+static uint64_t g_min_lo_ram, g_max_lo_ram, g_min_hi_ram, g_max_hi_ram;
 
-    return ptab_base;
+/* has to run before the kernel gets its e820 map, so it sees what we leave out */
+bool txt_prepare_pmrs(void)
+{
+    return get_ram_ranges(&g_min_lo_ram, &g_max_lo_ram,
+                          &g_min_hi_ram, &g_max_hi_ram);
 }
 
+/*
+ * has to run before the kernel gets its e820 map, so it sees the log, and
+ * after txt_prepare_pmrs(): the log goes inside the low PMR, which reserving
+ * it can no longer shrink
+ */
+bool txt_alloc_event_log(void)
+{
+    uint64_t base;
+
+    g_evtlog_size = calc_event_log_size();
+    base = e820_alloc(g_evtlog_size, PAGE_SIZE, g_max_lo_ram,
+                      E820_ALLOC_TOP_DOWN, E820_RESERVED);
+    if ( base == 0 ) {
+        printk(SLEXEC_ERR"no memory for a 0x%x byte event log\n",
+               g_evtlog_size);
+        return false;
+    }
+    /* same coverage txt_verify_senter_setup() checks, caught up front */
+    if ( base < g_min_lo_ram ) {
+        printk(SLEXEC_ERR"event log 0x%Lx (0x%x) not covered by the PMRs\n",
+               base, g_evtlog_size);
+        return false;
+    }
+
+    g_evtlog_base = (void *)(uint32_t)base;
+    sl_memset(g_evtlog_base, 0, g_evtlog_size);
+    printk(SLEXEC_DETA"event log at %p, size 0x%x\n", g_evtlog_base,
+           g_evtlog_size);
+
+    return true;
+}
 
-/* should be called after os_mle_data initialized */
+/* should be called after txt_alloc_event_log() */
 static void *init_event_log(void)
 {
-    os_mle_data_t *os_mle_data = get_os_mle_data_start(get_txt_heap());
-    g_elog = (event_log_container_t *)&os_mle_data->event_log_buffer;
+    g_elog = (event_log_container_t *)g_evtlog_base;
 
     sl_memcpy((void *)g_elog->signature, EVTLOG_SIGNATURE,
            sizeof(g_elog->signature));
@@ -247,8 +313,7 @@ static void *init_event_log(void)
     g_elog->container_ver_minor = EVTLOG_CNTNR_MINOR_VER;
     g_elog->pcr_event_ver_major = EVTLOG_EVT_MAJOR_VER;
     g_elog->pcr_event_ver_minor = EVTLOG_EVT_MINOR_VER;
-    //g_elog->size = sizeof(os_mle_data->event_log_buffer);
-    g_elog->size = MAX_EVENT_LOG_SIZE;
+    g_elog->size = g_evtlog_size;
     g_elog->pcr_events_offset = sizeof(*g_elog);
     g_elog->next_event_offset = sizeof(*g_elog);
 
@@ -258,10 +323,8 @@ static void *init_event_log(void)
 /* initialize TCG compliant TPM 2.0 event log descriptor */
 static void init_evtlog_desc_1(heap_event_log_ptr_elt2_1_t *evt_log)
 {
-    os_mle_data_t *os_mle_data = get_os_mle_data_start(get_txt_heap());
-
-    evt_log->phys_addr = (uint64_t)(unsigned long)(os_mle_data->event_log_buffer);
-    evt_log->allcoated_event_container_size = 2*PAGE_SIZE;
+    evt_log->phys_addr = (uint64_t)(unsigned long)g_evtlog_base;
+    evt_log->allcoated_event_container_size = g_evtlog_size;
     evt_log->first_record_offset = 0;
     evt_log->next_record_offset = 0;
     printk(SLEXEC_DETA"TCG compliant TPM 2.0 event log descriptor:\n");
@@ -371,9 +434,9 @@ static void init_slrt_storage(void)
 
     g_slr_entry_policy->hdr.tag = SLR_ENTRY_ENTRY_POLICY;
     g_slr_entry_policy->hdr.size = sizeof(struct slr_entry_policy) +
-                                   7*sizeof(struct slr_policy_entry);
+                                   SLR_POLICY_ENTRIES*sizeof(struct slr_policy_entry);
     g_slr_entry_policy->revision = 1;
-    g_slr_entry_policy->nr_entries = 7;
+    g_slr_entry_policy->nr_entries = SLR_POLICY_ENTRIES;
 
     g_slr_entry_intel_info.hdr.tag = SLR_ENTRY_INTEL_INFO;
     g_slr_entry_intel_info.hdr.size = sizeof(struct slr_entry_intel_info);
@@ -465,7 +528,7 @@ static void setup_slrt_policy(os_mle_data_t *os_mle_data)
     entry->pcr = 18;
     entry->entity_type = SLR_ET_TXT_OS2MLE;
     entry->entity = (uint32_t)os_mle_data;
-    entry->size = sizeof(os_mle_data_t) - MAX_EVENT_LOG_SIZE;
+    entry->size = sizeof(os_mle_data_t);
     sl_strcpy(&entry->evt_info[0], "Measured TXT OS-MLE data");
     printk(SLEXEC_DETA"TXT OS-MLE addr: 0x%x\n", (uint32_t)entry->entity);
     entry++;
@@ -504,17 +567,14 @@ static txt_heap_t *init_txt_heap(void *ptab_base, acm_hdr_t *sinit, loader_ctx *
     os_mle_data_t *os_mle_data;
     struct kernel_info *ki;
     uint32_t version;
-    uint64_t min_lo_ram, max_lo_ram, min_hi_ram, max_hi_ram;
     mtrr_state_t saved_mtrr_state = {0};
 
 
     txt_heap = get_txt_heap();
 
     /*
-     * BIOS data already setup by BIOS
+     * BIOS data already setup by BIOS, txt_verify_platform() checked it
      */
-    if ( !verify_bios_data(txt_heap) )
-        return NULL;
 
     init_slrt_storage();
 
@@ -537,8 +597,8 @@ static txt_heap_t *init_txt_heap(void *ptab_base, acm_hdr_t *sinit, loader_ctx *
            (uint32_t)os_mle_data->ap_wake_block_size);
 
     /* event log and size */
-    g_slr_entry_log_info.addr = (uint32_t)&os_mle_data->event_log_buffer;
-    g_slr_entry_log_info.size = MAX_EVENT_LOG_SIZE;
+    g_slr_entry_log_info.addr = (uint32_t)g_evtlog_base;
+    g_slr_entry_log_info.size = g_evtlog_size;
     g_slr_entry_log_info.format = (get_evtlog_type() == EVTLOG_TPM2_TCG) ?
                                    SLR_DRTM_TPM20_LOG : SLR_DRTM_TPM12_LOG;
     printk(SLEXEC_DETA"Event log addr: 0x%x\n", (uint32_t)g_slr_entry_log_info.addr);
@@ -594,12 +654,9 @@ static txt_heap_t *init_txt_heap(void *ptab_base, acm_hdr_t *sinit, loader_ctx *
     /* this is linear addr (offset from MLE base) of mle header */
     os_sinit_data->mle_hdr_base = g_slr_entry_dl_info.dlme_entry;
 
-    /* VT-d PMRs */
-    if ( !get_ram_ranges(&min_lo_ram, &max_lo_ram, &min_hi_ram, &max_hi_ram) )
-        return NULL;
-
-    set_vtd_pmrs(os_sinit_data, min_lo_ram, max_lo_ram, min_hi_ram,
-                 max_hi_ram);
+    /* VT-d PMRs, as worked out by txt_prepare_pmrs() */
+    set_vtd_pmrs(os_sinit_data, g_min_lo_ram, g_max_lo_ram, g_min_hi_ram,
+                 g_max_hi_ram);
 
     /* capabilities : choose monitor wake mechanism first */
     txt_caps_t sinit_caps = get_sinit_capabilities(sinit);
@@ -704,18 +761,48 @@ int txt_launch_environment(loader_ctx *lctx)
     print_file_info();
 
     /* create MLE page table */
+    timeline_start(BOOT_PHASE_PAGE_TABLE);
     mle_ptab_base = build_mle_pagetable();
     if ( mle_ptab_base == NULL )
         return SL_ERR_FATAL;
+    timeline_end(BOOT_PHASE_PAGE_TABLE);
 
     /* initialize TXT heap */
+    timeline_start(BOOT_PHASE_TXT_HEAP);
     txt_heap = init_txt_heap(mle_ptab_base, g_sinit_module, lctx);
     if ( txt_heap == NULL )
         return SL_ERR_TXT_NOT_SUPPORTED;
 
+    /*
+     * Need to update the MLE header with the size of the MLE. The field is
+     * the 9th dword in.
+     */
+    mle_size = (uint32_t*)(g_sl_kernel_setup.protected_mode_base +
+                           (uint32_t)g_slr_entry_dl_info.dlme_entry);
+    if (*(mle_size + 9) == 0) {
+        printk("Protected Mode Size: 0x%x MLE Reported Size: 0x%x\n",
+              (uint32_t)g_sl_kernel_setup.protected_mode_size, *(mle_size + 9));
+        printk("Setting MLE size\n");
+        *(mle_size + 9) = g_sl_kernel_setup.protected_mode_size;
+    }
+
+    /*
+     * catch what would otherwise be a TXT reset while the MTRRs are still
+     * the firmware's, so a failure leaves the caches as they were
+     */
+    if ( !txt_verify_senter_setup(mle_ptab_base) )
+        return SL_ERR_FATAL;
+
+    timeline_end(BOOT_PHASE_TXT_HEAP);
+
     /* set MTRRs properly for AC module (SINIT) */
-    if ( !set_mtrrs_for_acmod(g_sinit_module) )
+    timeline_start(BOOT_PHASE_MTRRS);
+    if ( !set_mtrrs_for_acmod(g_sinit_module) ||
+         !verify_mtrrs_for_acmod(g_sinit_module) )
         return SL_ERR_FATAL;
+    timeline_end(BOOT_PHASE_MTRRS);
+
+    timeline_start(BOOT_PHASE_LAUNCH);
 
     /* deactivate current locality */
     /* TODO why is it not done for 1.2 w/ release_locality() ? */
@@ -727,18 +814,8 @@ int txt_launch_environment(loader_ctx *lctx)
         }
     }
 
-    /*
-     * Need to update the MLE header with the size of the MLE. The field is
-     * the 9th dword in.
-     */
-    mle_size = (uint32_t*)(g_sl_kernel_setup.protected_mode_base +
-                           (uint32_t)g_slr_entry_dl_info.dlme_entry);
-    if (*(mle_size + 9) == 0) {
-        printk("Protected Mode Size: 0x%x MLE Reported Size: 0x%x\n",
-              (uint32_t)g_sl_kernel_setup.protected_mode_size, *(mle_size + 9));
-        printk("Setting MLE size\n");
-        *(mle_size + 9) = g_sl_kernel_setup.protected_mode_size;
-    }
+    timeline_end(BOOT_PHASE_LAUNCH);
+    print_timeline();
 
     printk(SLEXEC_INFO"executing GETSEC[SENTER]...\n");
     /* (optionally) pause before executing GETSEC[SENTER] */
@@ -33,6 +33,8 @@
  *
  */
 
+#define SLEXEC_LOG_SUBSYS_MAX SLEXEC_LOG_MAX_TXT
+
 #include <types.h>
 #include <stdbool.h>
 #include <slexec.h>
@@ -45,6 +47,7 @@
 #include <acpi.h>
 #include <e820.h>
 #include <tpm.h>
+#include <slr_table.h>
 #include <cmdline.h>
 #include <txt/smx.h>
 #include <txt/mle.h>
@@ -52,11 +55,8 @@
 #include <txt/acmod.h>
 #include <txt/mtrrs.h>
 #include <txt/heap.h>
-
-/*
- * CPUID feature info
- */
-static unsigned int g_cpuid_feat_info = 0;
+#include <linux.h>
+#include <platform.h>
 
 /*
  * IA32_FEATURE_CONTROL_MSR
@@ -66,7 +66,7 @@ static unsigned long g_feat_ctrl_msr;
 static bool supports_smx(void)
 {
     /* check that processor supports SMX instructions */
-    if ( !(g_cpuid_feat_info & CPUID_X86_FEATURE_SMX) ) {
+    if ( !(get_platform_info()->feat_ecx & CPUID_X86_FEATURE_SMX) ) {
         printk(SLEXEC_ERR"ERR: CPU does not support SMX\n");
         return false;
     }
@@ -89,6 +89,7 @@ static bool supports_smx(void)
                            FEATURE_CONTROL_SENTER_PARAM_CTL |
                            FEATURE_CONTROL_LOCK;
         wrmsrl(MSR_IA32_FEATURE_CONTROL, g_feat_ctrl_msr);
+        update_platform_feat_ctrl();
         return true;
 #else
         return false;
@@ -108,17 +109,12 @@ static bool supports_smx(void)
 
 int supports_txt(void)
 {
+    const platform_info_t *platform = get_platform_info();
     capabilities_t cap;
 
-    /* first get CPUID feature information */
-    g_cpuid_feat_info = cpuid_ecx(CPUID_X86_FEATURE_INFO_LEAF);
-
-    /* read feature control msr only if processor supports VMX or SMX instructions */
-    if ( (g_cpuid_feat_info & CPUID_X86_FEATURE_VMX) ||
-         (g_cpuid_feat_info & CPUID_X86_FEATURE_SMX) ) {
-        g_feat_ctrl_msr = rdmsr(MSR_IA32_FEATURE_CONTROL);
-        printk(SLEXEC_DETA"IA32_FEATURE_CONTROL_MSR: %08lx\n", g_feat_ctrl_msr);
-    }
+    /* feature control msr was only read if processor supports VMX or SMX */
+    g_feat_ctrl_msr = platform->feat_ctrl;
+    printk(SLEXEC_DETA"IA32_FEATURE_CONTROL_MSR: %08lx\n", g_feat_ctrl_msr);
 
     /* processor must support SMX */
     if ( !supports_smx() )
@@ -133,10 +129,12 @@ int supports_txt(void)
      * check that all needed SMX capabilities are supported
      */
 
-    cap = __getsec_capabilities(0);
+    cap = platform->getsec_caps;
     if ( cap.chipset_present ) {
-        if ( cap.senter && cap.sexit && cap.parameters && cap.smctrl &&
-             cap.wakeup ) {
+        if ( !platform->txt_valid )
+            printk(SLEXEC_ERR"smx_get_parameters() failed\n");
+        else if ( cap.senter && cap.sexit && cap.parameters && cap.smctrl &&
+                  cap.wakeup ) {
             printk(SLEXEC_INFO"TXT chipset and all needed capabilities present\n");
             return SL_ERR_NONE;
         }
@@ -155,12 +153,8 @@ int supports_txt(void)
 int txt_verify_platform(void)
 {
     txt_heap_t *txt_heap;
-    int err;
 
-    /* check TXT supported */
-    err = supports_txt();
-    if ( err != SL_ERR_NONE )
-        return err;
+    /* supports_txt() has already passed by the time we get here */
 
     if ( !vtd_bios_enabled() )
         return SL_ERR_VTD_NOT_SUPPORTED;
@@ -181,6 +175,303 @@ int txt_verify_platform(void)
     return SL_ERR_NONE;
 }
 
+/*
+ * Everything below checks what SINIT is going to check. A violation found
+ * by SINIT ends in a TXT reset and a power cycle, here it is just an error.
+ */
+
+#define PMR_ALIGN    0x200000ULL   /* PMRs are in 2MB granules */
+
+/*
+ * the MLE page tables have to map the MLE 1:1 from linear address 0
+ * *ptab_end is set to the end of the last table, as they sit in ascending
+ * order
+ */
+static bool verify_mle_pagetable(const void *ptab_base, uint64_t mle_size,
+                                 uint32_t *ptab_end)
+{
+    const uint64_t *pdpt = ptab_base;
+    const uint64_t *pd = NULL, *pt = NULL;
+    uint32_t mle_start = g_sl_kernel_setup.protected_mode_base;
+    uint32_t pages = PAGE_UP(mle_size) >> PAGE_SHIFT;
+    uint32_t i;
+
+    if ( (uint32_t)ptab_base & ~PAGE_MASK ) {
+        printk(SLEXEC_ERR"MLE page table not page aligned (%p)\n", ptab_base);
+        return false;
+    }
+    if ( (uint32_t)ptab_base >= mle_start ) {
+        printk(SLEXEC_ERR"MLE page table (%p) not below MLE (0x%x)\n",
+               ptab_base, mle_start);
+        return false;
+    }
+
+    if ( pages == 0 || pages > 4*512*512 ) {
+        printk(SLEXEC_ERR"MLE too large for the page tables\n");
+        return false;
+    }
+
+    /* one PDPT entry per started 1G of MLE, the rest empty */
+    for ( i = 0; i < 4; i++ ) {
+        bool used = i < (pages + 512*512 - 1) / (512*512);
+
+        if ( used != !!(pdpt[i] & 1) || (!used && pdpt[i] != 0) ) {
+            printk(SLEXEC_ERR"MLE PDPT malformed\n");
+            return false;
+        }
+    }
+
+    for ( i = 0; i < pages; i++ ) {
+        if ( (i % (512*512)) == 0 ) {
+            const uint64_t *prev_pd = pd;
+
+            pd = (const uint64_t *)(uint32_t)(pdpt[i / (512*512)] & PAGE_MASK);
+            if ( (uint32_t)pd <= (uint32_t)pdpt ||
+                 (prev_pd != NULL && (uint32_t)pd <= (uint32_t)prev_pd) ) {
+                printk(SLEXEC_ERR"MLE page directory %u misplaced (%p)\n",
+                       i / (512*512), pd);
+                return false;
+            }
+        }
+        if ( (i % 512) == 0 ) {
+            uint32_t pde = (i / 512) % 512;
+            const uint64_t *prev_pt = pt;
+
+            if ( !(pd[pde] & 1) ) {
+                printk(SLEXEC_ERR"MLE PDE %u not present\n", i / 512);
+                return false;
+            }
+            pt = (const uint64_t *)(uint32_t)(pd[pde] & PAGE_MASK);
+            /* tables have to sit in ascending order below the MLE */
+            if ( (uint32_t)pt <= (uint32_t)pd ||
+                 (prev_pt != NULL && (uint32_t)pt <= (uint32_t)prev_pt) ||
+                 (uint32_t)pt >= mle_start ) {
+                printk(SLEXEC_ERR"MLE page table %u misplaced (%p)\n",
+                       i / 512, pt);
+                return false;
+            }
+        }
+        if ( pt[i % 512] != MAKE_PDTE(mle_start + i*PAGE_SIZE) ) {
+            printk(SLEXEC_ERR"MLE PTE %u maps 0x%Lx, expected 0x%x\n",
+                   i, pt[i % 512] & ~0xfffULL,
+                   mle_start + i*PAGE_SIZE);
+            return false;
+        }
+    }
+
+    *ptab_end = (uint32_t)pt + PAGE_SIZE;
+    return true;
+}
+
+static bool verify_mle_hdr(const os_sinit_data_t *os_sinit_data)
+{
+    static const uuid_t mle_uuid = MLE_HDR_UUID;
+    const mle_hdr_t *mle_hdr;
+    uint64_t mle_size = os_sinit_data->mle_size;
+
+    if ( os_sinit_data->mle_hdr_base + sizeof(*mle_hdr) > mle_size ) {
+        printk(SLEXEC_ERR"MLE header (0x%Lx) outside of MLE (0x%Lx)\n",
+               os_sinit_data->mle_hdr_base, mle_size);
+        return false;
+    }
+
+    mle_hdr = (const mle_hdr_t *)(g_sl_kernel_setup.protected_mode_base +
+                                  (uint32_t)os_sinit_data->mle_hdr_base);
+    if ( sl_memcmp(&mle_hdr->uuid, &mle_uuid, sizeof(mle_uuid)) != 0 ) {
+        printk(SLEXEC_ERR"MLE header UUID mismatch\n");
+        return false;
+    }
+    if ( mle_hdr->length < offsetof(mle_hdr_t, cmdline_start_off) ) {
+        printk(SLEXEC_ERR"MLE header too short (%u)\n", mle_hdr->length);
+        return false;
+    }
+    if ( mle_hdr->mle_start_off >= mle_hdr->mle_end_off ||
+         mle_hdr->mle_end_off > mle_size ) {
+        printk(SLEXEC_ERR"MLE header range 0x%x-0x%x bogus (MLE size 0x%Lx)\n",
+               mle_hdr->mle_start_off, mle_hdr->mle_end_off, mle_size);
+        return false;
+    }
+    if ( mle_hdr->entry_point < mle_hdr->mle_start_off ||
+         mle_hdr->entry_point >= mle_hdr->mle_end_off ) {
+        printk(SLEXEC_ERR"MLE entry point 0x%x outside of MLE\n",
+               mle_hdr->entry_point);
+        return false;
+    }
+
+    return true;
+}
+
+static bool verify_pmrs(const os_sinit_data_t *os_sinit_data)
+{
+    if ( (os_sinit_data->vtd_pmr_lo_base | os_sinit_data->vtd_pmr_lo_size |
+          os_sinit_data->vtd_pmr_hi_base | os_sinit_data->vtd_pmr_hi_size) &
+         (PMR_ALIGN - 1) ) {
+        printk(SLEXEC_ERR"PMRs not 2MB aligned\n");
+        return false;
+    }
+    if ( os_sinit_data->vtd_pmr_lo_base + os_sinit_data->vtd_pmr_lo_size >
+         0x100000000ULL ) {
+        printk(SLEXEC_ERR"low PMR extends above 4GB\n");
+        return false;
+    }
+    if ( os_sinit_data->vtd_pmr_hi_size != 0 &&
+         os_sinit_data->vtd_pmr_hi_base < 0x100000000ULL ) {
+        printk(SLEXEC_ERR"high PMR starts below 4GB\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* is [base, base + size) inside one of the PMRs */
+static bool pmr_covers(const os_sinit_data_t *os_sinit_data, uint64_t base,
+                       uint64_t size)
+{
+    uint64_t end = base + size;
+
+    if ( base >= os_sinit_data->vtd_pmr_lo_base &&
+         end <= os_sinit_data->vtd_pmr_lo_base + os_sinit_data->vtd_pmr_lo_size )
+        return true;
+    if ( base >= os_sinit_data->vtd_pmr_hi_base &&
+         end <= os_sinit_data->vtd_pmr_hi_base + os_sinit_data->vtd_pmr_hi_size )
+        return true;
+
+    return false;
+}
+
+/*
+ * the event log SINIT is pointed at has to be the one the SLR table hands
+ * the kernel, and DMA protected
+ */
+static bool verify_event_log(const txt_heap_t *txt_heap,
+                             const os_sinit_data_t *os_sinit_data)
+{
+    const os_mle_data_t *os_mle_data = get_os_mle_data_start(txt_heap);
+    const heap_ext_data_element_t *elt = os_sinit_data->ext_data_elts;
+    struct slr_table *slrt = (struct slr_table *)(uint32_t)os_mle_data->slrt;
+    const struct slr_entry_log_info *log_info;
+    uint64_t log_base = 0, log_size = 0;
+
+    if ( os_sinit_data->version < 6 )
+        return true;
+
+    for ( ; elt->type != HEAP_EXTDATA_TYPE_END;
+          elt = (void *)elt + elt->size ) {
+        if ( elt->size < sizeof(*elt) ) {
+            printk(SLEXEC_ERR"bad OS to SINIT data element size\n");
+            return false;
+        }
+        if ( elt->type == HEAP_EXTDATA_TYPE_TPM_EVENT_LOG_PTR ) {
+            const event_log_container_t *elog = (const void *)(uint32_t)
+                ((heap_event_log_ptr_elt_t *)elt->data)->event_log_phys_addr;
+            log_base = (uint32_t)elog;
+            log_size = elog->size;
+        }
+        else if ( elt->type == HEAP_EXTDATA_TYPE_TPM_EVENT_LOG_PTR_2_1 ) {
+            const heap_event_log_ptr_elt2_1_t *log = (const void *)elt->data;
+            log_base = log->phys_addr;
+            log_size = log->allcoated_event_container_size;
+        }
+    }
+
+    if ( log_base == 0 || log_size == 0 ) {
+        printk(SLEXEC_ERR"no event log pointer in OS to SINIT data\n");
+        return false;
+    }
+
+    log_info = (const struct slr_entry_log_info *)
+        slr_next_entry_by_tag(slrt, NULL, SLR_ENTRY_LOG_INFO);
+    if ( log_info == NULL || log_info->addr != log_base ||
+         log_info->size != log_size ) {
+        printk(SLEXEC_ERR"event log 0x%Lx (0x%Lx) differs from the SLR table's\n",
+               log_base, log_size);
+        return false;
+    }
+
+    if ( !pmr_covers(os_sinit_data, log_base, log_size) ) {
+        printk(SLEXEC_ERR"event log 0x%Lx (0x%Lx) not covered by the PMRs\n",
+               log_base, log_size);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * everything but the MTRRs, which verify_mtrrs_for_acmod() checks once
+ * set_mtrrs_for_acmod() has programmed them
+ */
+bool txt_verify_senter_setup(const void *mle_ptab)
+{
+    const acm_hdr_t *sinit = g_sinit_module;
+    const platform_info_t *platform = get_platform_info();
+    const txt_heap_t *txt_heap = get_txt_heap();
+    const os_sinit_data_t *os_sinit_data;
+    uint64_t used, os_sinit_size;
+    uint32_t version, ptab_end;
+
+    /* heap regions have to fit, with room left for the SINIT to MLE data */
+    used = get_bios_data_size(txt_heap) + get_os_mle_data_size(txt_heap);
+    if ( used >= platform->heap_size ) {
+        printk(SLEXEC_ERR"TXT heap overflow (0x%Lx of 0x%Lx)\n",
+               used, platform->heap_size);
+        return false;
+    }
+    os_sinit_size = get_os_sinit_data_size(txt_heap);
+    used += os_sinit_size + sizeof(uint64_t);
+    if ( used > platform->heap_size ) {
+        printk(SLEXEC_ERR"TXT heap overflow (0x%Lx of 0x%Lx)\n",
+               used, platform->heap_size);
+        return false;
+    }
+
+    /* OS to SINIT data version and size */
+    os_sinit_data = get_os_sinit_data_start(txt_heap);
+    version = os_sinit_data->version;
+    if ( version < MIN_OS_SINIT_DATA_VER || version > MAX_OS_SINIT_DATA_VER ||
+         version > get_supported_os_sinit_data_ver(sinit) ) {
+        printk(SLEXEC_ERR"OS to SINIT data version %u not supported\n", version);
+        return false;
+    }
+    if ( os_sinit_size != calc_os_sinit_data_size(version) ) {
+        printk(SLEXEC_ERR"OS to SINIT data size 0x%Lx, expected 0x%Lx\n",
+               os_sinit_size, calc_os_sinit_data_size(version));
+        return false;
+    }
+
+    if ( os_sinit_data->mle_ptab != (uint32_t)mle_ptab ||
+         os_sinit_data->mle_size == 0 ||
+         os_sinit_data->mle_size > g_sl_kernel_setup.protected_mode_size ) {
+        printk(SLEXEC_ERR"OS to SINIT MLE fields bogus\n");
+        return false;
+    }
+
+    if ( !verify_mle_pagetable(mle_ptab, os_sinit_data->mle_size, &ptab_end) )
+        return false;
+    if ( !verify_mle_hdr(os_sinit_data) )
+        return false;
+    if ( !verify_pmrs(os_sinit_data) )
+        return false;
+    /* SINIT measures the MLE through its page tables, both DMA protected */
+    if ( !pmr_covers(os_sinit_data, g_sl_kernel_setup.protected_mode_base,
+                     os_sinit_data->mle_size) ) {
+        printk(SLEXEC_ERR"MLE 0x%x (0x%Lx) not covered by the PMRs\n",
+               g_sl_kernel_setup.protected_mode_base, os_sinit_data->mle_size);
+        return false;
+    }
+    if ( !pmr_covers(os_sinit_data, (uint32_t)mle_ptab,
+                     ptab_end - (uint32_t)mle_ptab) ) {
+        printk(SLEXEC_ERR"MLE page tables %p - 0x%x not covered by the PMRs\n",
+               mle_ptab, ptab_end);
+        return false;
+    }
+    if ( !verify_event_log(txt_heap, os_sinit_data) )
+        return false;
+
+    printk(SLEXEC_INFO"SENTER setup verified\n");
+    return true;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -75,7 +75,7 @@ static void __putc(uint8_t x, uint8_t y, int c)
     screen[(y * MAX_COLS) + x] = (COLOR << 8) | c;
 }
 
-static void vga_putc(int c)
+void vga_putc(int c)
 {
     bool new_row = false;
 